@@ -0,0 +1,572 @@
+/**
+ * bigint.h
+ * Purpose: arbitrary precision integers, with fast multiplication
+ *
+ * @author Kirito Feng
+ * @version 1.0
+ */
+
+#ifndef BIGINT_H
+
+#define BIGINT_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "convolve.h"
+
+/**
+ * Internal helpers for bigint.h. Nothing in this namespace is part of the interface.
+ *
+ * Magnitudes are little-endian arrays of limbs in base 10^9, so that decimal conversion takes linear time.
+ */
+
+namespace bigint_detail {
+
+    const uint32_t base = 1000000000;
+
+    const int base_digits = 9;
+
+    /**
+     *  Below this many limbs in the shorter factor, schoolbook multiplication is fastest.
+     */
+
+    const size_t karatsuba_threshold = 40;
+
+    /**
+     *  From this many limbs in the shorter factor, multiplication goes through a transform.
+     */
+
+    const size_t transform_threshold = 200;
+
+    /**
+     *  From this many limbs in the shorter factor, the NTT is faster than the FFT, which has to split every limb into three coefficients.
+     */
+
+    const size_t ntt_threshold = 65536;
+
+    /**
+     *  Above this many limbs in the product, the NTT falls out of cache and the FFT, whose six-step algorithm does not, is faster again.
+     */
+
+    const size_t ntt_max_length = size_t(1) << 20;
+
+    /**
+     *  The largest coefficient of a product computed with the double precision FFT must stay below 2^fft_safe_bits.
+     *
+     *  The rounding error of the FFT grows in proportion to the largest coefficient, and reaches about 1/4 near 2^48. This leaves a margin of 16.
+     */
+
+    const int fft_safe_bits = 44;
+
+    /**
+     *  Adds src to dst, in place, propagating the carry through dst.
+     *
+     *  @param dst the first of nd limbs to add to.
+     *  @param src the first of ns limbs to add. ns must not exceed nd, and the sum must fit in nd limbs.
+     */
+
+    inline void add_to(uint32_t *dst, size_t nd, const uint32_t *src, size_t ns) {
+        uint32_t carry = 0;
+        size_t i = 0;
+
+        for(; i < ns; ++ i) {
+            uint32_t s = dst[i] + src[i] + carry;
+            carry = s >= base;
+            dst[i] = carry ? s - base : s;
+        }
+
+        for(; carry && i < nd; ++ i) {
+            carry = ++ dst[i] == base;
+            if(carry) dst[i] = 0;
+        }
+
+        assert(!carry);
+    }
+
+    /**
+     *  Subtracts src from dst, in place, propagating the borrow through dst.
+     *
+     *  @param dst the first of nd limbs to subtract from.
+     *  @param src the first of ns limbs to subtract. ns must not exceed nd, and src must not exceed dst.
+     */
+
+    inline void sub_from(uint32_t *dst, size_t nd, const uint32_t *src, size_t ns) {
+        uint32_t borrow = 0;
+        size_t i = 0;
+
+        for(; i < ns; ++ i) {
+            uint32_t s = src[i] + borrow;
+            borrow = dst[i] < s;
+            dst[i] = borrow ? dst[i] + base - s : dst[i] - s;
+        }
+
+        for(; borrow && i < nd; ++ i) {
+            borrow = dst[i] == 0;
+            dst[i] = borrow ? base - 1 : dst[i] - 1;
+        }
+
+        assert(!borrow);
+    }
+
+    /**
+     *  Compares two magnitudes.
+     *
+     *  @return -1, 0 or 1 as a is less than, equal to or greater than b.
+     */
+
+    inline int compare(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b) {
+        if(a.size() != b.size()) return a.size() < b.size() ? -1 : 1;
+
+        for(size_t i = a.size(); i -- > 0;)
+            if(a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+
+        return 0;
+    }
+
+    /**
+     *  Removes the leading zero limbs of a magnitude.
+     */
+
+    inline void trim(std::vector<uint32_t> &a) {
+        while(!a.empty() && a.back() == 0) a.pop_back();
+    }
+
+    /**
+     *  Propagates the carries of a product given as coefficients in base 10^9.
+     *
+     *  Every coefficient is first split into three limbs, in a pass with no dependency between iterations. This leaves sums of at most a few times the base, whose small carries are rippled through in a second, short pass.
+     *
+     *  @param c the coefficients of the product.
+     *  @param h if not null, high parts of the coefficients, which stand for c[i] + h[i] 10^9. Each must be below 10^18.
+     *  @param n the number of coefficients.
+     *  @param out the first of nout limbs to write the product to. The product must fit in them.
+     */
+
+    inline void carry(const uint64_t *c, const uint64_t *h, size_t n, uint32_t *out, size_t nout) {
+        std::vector<uint64_t> acc(n + 3, 0);
+
+        for(size_t i = 0; i < n; ++ i) {
+            uint64_t q = c[i] / base;
+            acc[i] += c[i] - q * base;
+            acc[i + 1] += q % base;
+            acc[i + 2] += q / base;
+        }
+
+        if(h) {
+            for(size_t i = 0; i < n; ++ i) {
+                acc[i + 1] += h[i] % base;
+                acc[i + 2] += h[i] / base;
+            }
+        }
+
+        uint64_t r = 0;
+
+        for(size_t i = 0; i < acc.size(); ++ i) {
+            uint64_t s = acc[i] + r;
+            r = s / base;
+            if(i < nout) out[i] = uint32_t(s - r * base);
+            else assert(s == 0);
+        }
+    }
+
+    /**
+     *  Multiplies two magnitudes with the schoolbook method.
+     *
+     *  @param out the first of na + nb limbs, all zero, to write the product to.
+     */
+
+    inline void mul_schoolbook(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+        for(size_t i = 0; i < na; ++ i) {
+            uint64_t carry = 0;
+            for(size_t j = 0; j < nb; ++ j) {
+                uint64_t cur = out[i + j] + uint64_t(a[i]) * b[j] + carry;
+                carry = cur / base;
+                out[i + j] = uint32_t(cur - carry * base);
+            }
+            out[i + nb] = uint32_t(carry);
+        }
+    }
+
+    /**
+     *  Multiplies two magnitudes through the double precision FFT.
+     *
+     *  Each limb is split into three coefficients of three digits, and the coefficients are convolved with convolve(), which packs both factors into a single complex transform.
+     *  The caller must keep the largest coefficient of the product below 2^fft_safe_bits.
+     *
+     *  @param out the first of na + nb limbs to write the product to.
+     */
+
+    inline void mul_fft(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+        auto split = [](const uint32_t *x, size_t n) {
+            std::vector<double> ret(3 * n);
+            for(size_t i = 0; i < n; ++ i) {
+                ret[3 * i] = x[i] % 1000;
+                ret[3 * i + 1] = x[i] / 1000 % 1000;
+                ret[3 * i + 2] = x[i] / 1000000;
+            }
+            return ret;
+        };
+
+        std::vector<double> c = convolve(split(a, na), split(b, nb));
+
+        c.resize(3 * (na + nb), 0);
+
+        // Below 2^44, the coefficients regroup into c0 + 1000 c1 + 10^6 c2 < 2^64.
+
+        std::vector<uint64_t> d(na + nb);
+
+        for(size_t i = 0; i < d.size(); ++ i)
+            d[i] = uint64_t(std::llround(c[3 * i])) + uint64_t(std::llround(c[3 * i + 1])) * 1000 + uint64_t(std::llround(c[3 * i + 2])) * 1000000;
+
+        carry(d.data(), nullptr, d.size(), out, na + nb);
+    }
+
+    /**
+     *  Multiplies two magnitudes exactly through the NTT, one limb per coefficient.
+     *
+     *  The limbs are convolved modulo the three primes of convolve_exact. The coefficients of the product reach 10^18 nb, beyond 64 bits, so Garner's recombination is carried out here, straight into base 10^9.
+     *  na + nb - 1 must not exceed 2^23.
+     *
+     *  @param out the first of na + nb limbs to write the product to.
+     */
+
+    inline void mul_ntt(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+        const uint32_t m0 = 998244353, m1 = 167772161, m2 = 469762049;
+
+        auto residues = [](const uint32_t *x, size_t n, uint32_t m) {
+            std::vector<uint32_t> ret(x, x + n);
+            for(auto &v: ret) v %= m;
+            return ret;
+        };
+
+        std::vector<uint32_t> r0 = ntt_convolve<m0, 3>(residues(a, na, m0), residues(b, nb, m0));
+        std::vector<uint32_t> r1 = ntt_convolve<m1, 3>(residues(a, na, m1), residues(b, nb, m1));
+        std::vector<uint32_t> r2 = ntt_convolve<m2, 3>(residues(a, na, m2), residues(b, nb, m2));
+
+        const uint64_t inv01 = ntt_detail::power(m0, m1 - 2, m1);
+        const uint64_t inv012 = ntt_detail::power(uint64_t(m0) * m1 % m2, m2 - 2, m2);
+
+        // m0 m1 = p1 10^9 + p0.
+        const uint64_t p1 = uint64_t(m0) * m1 / base, p0 = uint64_t(m0) * m1 % base;
+
+        std::vector<uint64_t> lo(r0.size()), hi(r0.size());
+
+        for(size_t i = 0; i < r0.size(); ++ i) {
+            uint64_t x0 = r0[i];
+            uint64_t x1 = (r1[i] + m1 - x0 % m1) % m1 * inv01 % m1;
+            uint64_t x2 = (r2[i] + 2 * uint64_t(m2) - (x0 + m0 * x1) % m2) % m2 * inv012 % m2;
+
+            lo[i] = x0 + m0 * x1 + p0 * x2;
+            hi[i] = p1 * x2;
+        }
+
+        carry(lo.data(), hi.data(), lo.size(), out, na + nb);
+    }
+
+    /**
+     *  Multiplies two magnitudes, choosing the method by size.
+     *
+     *  Short factors use the schoolbook method. Long factors go through the FFT, splitting limbs finely enough to keep its rounding error safe, or through the exact NTT in the range of sizes where it is faster.
+     *  Karatsuba's method covers the sizes between, and also splits factors too long for the FFT to multiply safely. Unbalanced factors are multiplied in slices of the shorter length.
+     *
+     *  @param out the first of na + nb limbs, all zero, to write the product to.
+     */
+
+    inline void mul(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out) {
+        if(na < nb) {
+            std::swap(a, b);
+            std::swap(na, nb);
+        }
+
+        if(nb == 0) return;
+
+        if(nb < karatsuba_threshold) {
+            mul_schoolbook(a, na, b, nb, out);
+            return;
+        }
+
+        if(na >= 2 * nb) {
+            std::vector<uint32_t> t(2 * nb);
+            for(size_t i = 0; i < na; i += nb) {
+                size_t n = std::min(nb, na - i);
+                std::fill(t.begin(), t.end(), 0);
+                mul(a + i, n, b, nb, t.data());
+                add_to(out + i, na + nb - i, t.data(), n + nb);
+            }
+            return;
+        }
+
+        if(nb >= ntt_threshold && na + nb <= ntt_max_length) {
+            mul_ntt(a, na, b, nb, out);
+            return;
+        }
+
+        // 3 nb coefficients below 1000 each make the largest coefficient of the product below 3 nb 999^2.
+        // Longer factors are split by Karatsuba's method until they fit.
+
+        if(nb >= transform_threshold && std::log2(3.0 * nb * 999 * 999) <= fft_safe_bits) {
+            mul_fft(a, na, b, nb, out);
+            return;
+        }
+
+        // a b = z2 B^2h + ((a0 + a1) (b0 + b1) - z0 - z2) B^h + z0, with z0 = a0 b0 and z2 = a1 b1.
+
+        size_t h = na / 2;
+
+        mul(a, h, b, h, out);
+        mul(a + h, na - h, b + h, nb - h, out + 2 * h);
+
+        std::vector<uint32_t> sa(na - h + 1, 0), sb(na - h + 1, 0);
+
+        std::copy(a + h, a + na, sa.begin());
+        std::copy(b + h, b + nb, sb.begin());
+        add_to(sa.data(), sa.size(), a, h);
+        add_to(sb.data(), sb.size(), b, h);
+
+        std::vector<uint32_t> z1(sa.size() + sb.size(), 0);
+
+        mul(sa.data(), sa.size(), sb.data(), sb.size(), z1.data());
+        sub_from(z1.data(), z1.size(), out, 2 * h);
+        sub_from(z1.data(), z1.size(), out + 2 * h, na + nb - 2 * h);
+
+        size_t n = z1.size();
+        while(n > 0 && z1[n - 1] == 0) -- n;
+
+        add_to(out + h, na + nb - h, z1.data(), n);
+    }
+}
+
+/**
+ * An arbitrary precision signed integer.
+ *
+ * The magnitude is stored in base 10^9, so conversion to and from decimal strings takes linear time.
+ * Multiplication picks the schoolbook method, Karatsuba's method, the FFT of fft.h or the exact NTT of ntt.h by the size of its factors.
+ */
+
+class bigint {
+
+    private:
+
+    // The magnitude, least significant limb first, with no leading zero limbs. Zero has no limbs.
+
+    std::vector<uint32_t> limbs;
+
+    bool negative;
+
+    inline void normalize() {
+        bigint_detail::trim(limbs);
+        if(limbs.empty()) negative = false;
+    }
+
+    public:
+
+    /**
+     *  Constructs a bigint from a machine integer.
+     *
+     *  @param v the value.
+     */
+
+    inline bigint(long long v = 0): negative(v < 0) {
+        unsigned long long m = negative ? 0 - (unsigned long long) v : (unsigned long long) v;
+        while(m > 0) {
+            limbs.push_back(uint32_t(m % bigint_detail::base));
+            m /= bigint_detail::base;
+        }
+    }
+
+    /**
+     *  Constructs a bigint from its decimal representation.
+     *
+     *  @param s the decimal digits, optionally preceded by a sign.
+     */
+
+    explicit bigint(const std::string &s): negative(false) {
+        size_t first = 0;
+
+        if(!s.empty() && (s[0] == '-' || s[0] == '+')) {
+            negative = s[0] == '-';
+            first = 1;
+        }
+
+        assert(first < s.size());
+
+        for(size_t end = s.size(); end > first;) {
+            size_t begin = end >= first + bigint_detail::base_digits ? end - bigint_detail::base_digits : first;
+            uint32_t limb = 0;
+            for(size_t i = begin; i < end; ++ i) {
+                assert(s[i] >= '0' && s[i] <= '9');
+                limb = limb * 10 + uint32_t(s[i] - '0');
+            }
+            limbs.push_back(limb);
+            end = begin;
+        }
+
+        normalize();
+    }
+
+    /**
+     *  Converts the bigint to its decimal representation.
+     *
+     *  @return the decimal digits, preceded by a minus sign if the value is negative.
+     */
+
+    std::string to_string() const {
+        if(limbs.empty()) return "0";
+
+        std::string ret = negative ? "-" : "";
+
+        ret += std::to_string(limbs.back());
+
+        for(size_t i = limbs.size() - 1; i -- > 0;) {
+            std::string d = std::to_string(limbs[i]);
+            ret += std::string(bigint_detail::base_digits - d.size(), '0') + d;
+        }
+
+        return ret;
+    }
+
+    /**
+     *  Gets the negation of the bigint.
+     *
+     *  @return the negation of the bigint.
+     */
+
+    inline bigint operator - () const {
+        bigint ret(*this);
+        if(!ret.limbs.empty()) ret.negative = !negative;
+        return ret;
+    }
+
+    /**
+     *  Adds two bigints.
+     *
+     *  @param b the bigint to add.
+     *  @return the sum of the two bigints.
+     */
+
+    bigint operator + (const bigint &b) const {
+        if(negative != b.negative) return *this - (-b);
+
+        bigint ret;
+
+        const std::vector<uint32_t> &x = limbs.size() >= b.limbs.size() ? limbs : b.limbs, &y = limbs.size() >= b.limbs.size() ? b.limbs : limbs;
+
+        ret.limbs = x;
+        ret.limbs.push_back(0);
+        bigint_detail::add_to(ret.limbs.data(), ret.limbs.size(), y.data(), y.size());
+        ret.negative = negative;
+        ret.normalize();
+
+        return ret;
+    }
+
+    /**
+     *  Subtracts a bigint from this one.
+     *
+     *  @param b the bigint to subtract.
+     *  @return the difference of the two bigints.
+     */
+
+    bigint operator - (const bigint &b) const {
+        if(negative != b.negative) return *this + (-b);
+
+        bigint ret;
+
+        bool swap = bigint_detail::compare(limbs, b.limbs) < 0;
+
+        ret.limbs = swap ? b.limbs : limbs;
+        const std::vector<uint32_t> &y = swap ? limbs : b.limbs;
+        bigint_detail::sub_from(ret.limbs.data(), ret.limbs.size(), y.data(), y.size());
+        ret.negative = negative != swap;
+        ret.normalize();
+
+        return ret;
+    }
+
+    /**
+     *  Multiplies two bigints.
+     *
+     *  @param b the bigint to multiply by.
+     *  @return the product of the two bigints.
+     */
+
+    bigint operator * (const bigint &b) const {
+        bigint ret;
+
+        if(limbs.empty() || b.limbs.empty()) return ret;
+
+        ret.limbs.assign(limbs.size() + b.limbs.size(), 0);
+        bigint_detail::mul(limbs.data(), limbs.size(), b.limbs.data(), b.limbs.size(), ret.limbs.data());
+        ret.negative = negative != b.negative;
+        ret.normalize();
+
+        return ret;
+    }
+
+    inline bigint &operator += (const bigint &b) {
+        return *this = *this + b;
+    }
+
+    inline bigint &operator -= (const bigint &b) {
+        return *this = *this - b;
+    }
+
+    inline bigint &operator *= (const bigint &b) {
+        return *this = *this * b;
+    }
+
+    /**
+     *  Checks if two bigints are equal.
+     *
+     *  @param b the bigint to compare to.
+     *  @return true if the two bigints are equal, false otherwise.
+     */
+
+    inline bool operator == (const bigint &b) const {
+        return negative == b.negative && limbs == b.limbs;
+    }
+
+    /**
+     *  Checks if two bigints are not equal.
+     *
+     *  @param b the bigint to compare to.
+     *  @return true if the two bigints are not equal, false otherwise.
+     */
+
+    inline bool operator != (const bigint &b) const {
+        return !(*this == b);
+    }
+
+    /**
+     *  Compares two bigints.
+     *
+     *  @param b the bigint to compare to.
+     *  @return true if this bigint is less than b, false otherwise.
+     */
+
+    inline bool operator < (const bigint &b) const {
+        if(negative != b.negative) return negative;
+        int c = bigint_detail::compare(limbs, b.limbs);
+        return negative ? c > 0 : c < 0;
+    }
+
+    /**
+     *  Prints the bigint in decimal.
+     *
+     *  @param out the output stream.
+     *  @param b the bigint to print.
+     *  @return the output stream.
+     */
+
+    friend std::ostream &operator << (std::ostream &out, const bigint &b) {
+        return out << b.to_string();
+    }
+};
+
+#endif
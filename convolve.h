@@ -0,0 +1,417 @@
+/**
+ * convolve.h
+ * Purpose: fast convolution and polynomial multiplication
+ *
+ * @author Kirito Feng
+ * @version 1.0
+ */
+
+#ifndef CONVOLVE_H
+
+#define CONVOLVE_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "fft.h"
+#include "ntt.h"
+
+/**
+ * Below this many values in the shorter input, direct convolution is faster than going through the FFT.
+ */
+
+const size_t convolve_direct_threshold = 48;
+
+/**
+ * The same threshold for integer sequences, which are convolved through three NTTs rather than one FFT.
+ */
+
+const size_t convolve_exact_threshold = 320;
+
+/**
+ * Computes the linear convolution of two sequences directly, in O(a.size() b.size()) time.
+ *
+ * @param a the first sequence.
+ * @param b the second sequence.
+ * @return the a.size() + b.size() - 1 values of the convolution, or nothing if either sequence is empty.
+ */
+
+template <typename T>
+std::vector<T> convolve_direct(const std::vector<T> &a, const std::vector<T> &b) {
+    if(a.empty() || b.empty()) return std::vector<T>();
+
+    std::vector<T> ret(a.size() + b.size() - 1, T(0));
+
+    for(size_t i = 0; i < a.size(); ++ i)
+        for(size_t j = 0; j < b.size(); ++ j)
+            ret[i + j] += a[i] * b[j];
+
+    return ret;
+}
+
+/**
+ * Internal helpers for convolve.h. Nothing in this namespace is part of the interface.
+ */
+
+namespace convolve_detail {
+
+    /**
+     *  Convolves two integer sequences exactly, through the Number Theoretic Transform.
+     */
+
+    template <typename T>
+    std::vector<T> convolve(const std::vector<T> &a, const std::vector<T> &b, std::true_type) {
+        return convolve_exact(a, b);
+    }
+
+    /**
+     *  Convolves two floating point sequences through the FFT.
+     *
+     *  Both inputs are packed into one complex sequence, a + ib, and transformed together, and the product is inverted with a real transform of half the size.
+     */
+
+    template <typename T>
+    std::vector<T> convolve(const std::vector<T> &a, const std::vector<T> &b, std::false_type) {
+        size_t L = a.size() + b.size() - 1, N = 2;
+
+        while(N < L) N <<= 1;
+
+        std::vector<std::complex<T>> P(N);
+
+        for(size_t i = 0; i < a.size(); ++ i) P[i].real(a[i]);
+        for(size_t i = 0; i < b.size(); ++ i) P[i].imag(b[i]);
+
+        cached_fft_plan<T>(N).execute(P.data(), 1);
+
+        // With Q = conj(P[N - k]), A = (P[k] + Q) / 2 and B = (P[k] - Q) / 2i, so A B = (P[k]^2 - Q^2) / 4i.
+        // The product is Hermitian, so only its first N / 2 + 1 values are needed.
+
+        std::vector<std::complex<T>> C(N / 2 + 1);
+
+        for(size_t k = 0; k <= N / 2; ++ k) {
+            std::complex<T> p = P[k], q = std::conj(P[(N - k) & (N - 1)]);
+            C[k] = (fft_detail::cmul(p, p) - fft_detail::cmul(q, q)) * std::complex<T>(0, -0.25);
+        }
+
+        std::vector<T> ret(N);
+
+        cached_rfft_plan<T>(N).execute(C.data(), ret.data());
+
+        ret.resize(L);
+
+        return ret;
+    }
+}
+
+/**
+ * Computes the linear convolution of two real sequences, which is also the product of the polynomials with those coefficients.
+ *
+ * Short inputs are convolved directly. Otherwise floating point sequences are packed into one complex sequence and convolved through the FFT in their own precision, and integer sequences are convolved exactly with convolve_exact.
+ * Plans come from the calling thread's cache, so repeated convolutions of similar sizes compute no twiddle factors.
+ *
+ * @param a the first sequence.
+ * @param b the second sequence.
+ * @return the a.size() + b.size() - 1 values of the convolution, or nothing if either sequence is empty.
+ */
+
+template <typename T>
+std::vector<T> convolve(const std::vector<T> &a, const std::vector<T> &b) {
+    if(std::min(a.size(), b.size()) < (std::is_integral<T>::value ? convolve_exact_threshold : convolve_direct_threshold)) return convolve_direct(a, b);
+
+    return convolve_detail::convolve(a, b, std::is_integral<T>());
+}
+
+/**
+ * Computes the linear convolution of two complex sequences.
+ *
+ * Short inputs are convolved directly. Otherwise both inputs are transformed, multiplied and inverted, using the calling thread's cached plans.
+ *
+ * @param a the first sequence.
+ * @param b the second sequence.
+ * @return the a.size() + b.size() - 1 values of the convolution, or nothing if either sequence is empty.
+ */
+
+template <typename T>
+std::vector<std::complex<T>> convolve(const std::vector<std::complex<T>> &a, const std::vector<std::complex<T>> &b) {
+    if(std::min(a.size(), b.size()) < convolve_direct_threshold) return convolve_direct(a, b);
+
+    size_t L = a.size() + b.size() - 1, N = 1;
+
+    while(N < L) N <<= 1;
+
+    const fft_plan<T> &plan = cached_fft_plan<T>(N);
+
+    std::vector<std::complex<T>> A(a), B(b);
+
+    A.resize(N);
+    B.resize(N);
+
+    plan.execute(A.data(), 1);
+    plan.execute(B.data(), 1);
+
+    for(size_t k = 0; k < N; ++ k)
+        A[k] = fft_detail::cmul(A[k], B[k]);
+
+    plan.execute(A.data(), -1);
+
+    A.resize(L);
+
+    return A;
+}
+
+/**
+ * A streaming convolver, which filters an unbounded signal with a fixed kernel using overlap-save.
+ *
+ * The signal is processed in blocks of block_size() samples. Each block is transformed together with the taps - 1 samples before it, multiplied by the kernel's spectrum (computed once, in the constructor), and inverted.
+ * The first taps - 1 outputs of the inverse are wrapped around, and the last block_size() are the filtered block.
+ * Memory is bounded by the transform size, and each output sample is available as soon as the block holding its input is processed.
+ *
+ * A convolver holds the tail of the signal between calls, so each instance must only be used by one thread at a time.
+ *
+ * @param T the floating point type of the signal.
+ */
+
+template <typename T = double>
+class convolver {
+
+    private:
+
+    size_t taps, block;
+
+    std::shared_ptr<const rfft_plan<T>> plan;
+
+    std::vector<std::complex<T>> kernel;
+
+    // The last plan->size() samples of the input, oldest first, and the buffers for the transform of a block.
+
+    std::vector<T> window;
+
+    std::vector<std::complex<T>> X;
+
+    std::vector<T> y;
+
+    public:
+
+    /**
+     *  Constructs a convolver for a kernel.
+     *
+     *  @param h the kernel, which must not be empty.
+     *  @param block the number of samples per block, or 0 to pick a block about as long as the kernel, which minimises the work per sample.
+     *  @throws std::invalid_argument if h is empty.
+     */
+
+    explicit convolver(const std::vector<T> &h, size_t block = 0): taps(h.size()) {
+        if(h.empty()) throw std::invalid_argument("convolver: the kernel must not be empty");
+
+        size_t N = 2;
+        while(N < (block ? block : taps) + taps - 1) N <<= 1;
+        if(!block && N < 2 * taps) N <<= 1;
+
+        this->block = block ? block : N - taps + 1;
+        plan = std::make_shared<const rfft_plan<T>>(N);
+
+        std::vector<T> padded(h);
+        padded.resize(N);
+        plan->execute(padded, kernel);
+
+        window.assign(N, T(0));
+        X.resize(N / 2 + 1);
+        y.resize(N);
+    }
+
+    /**
+     *  Retrieves the number of samples consumed and produced by each call to process.
+     *
+     *  @return the block size.
+     */
+
+    inline size_t block_size() const {
+        return block;
+    }
+
+    /**
+     *  Filters the next block of the signal.
+     *
+     *  @param in the next block_size() samples of the signal.
+     *  @param out overwritten with the block_size() filtered samples. This may equal in.
+     */
+
+    void process(const T *in, T *out) {
+        std::copy(window.begin() + block, window.end(), window.begin());
+        std::copy(in, in + block, window.end() - block);
+
+        plan->execute(window.data(), X.data());
+
+        for(size_t k = 0; k < X.size(); ++ k)
+            X[k] = fft_detail::cmul(X[k], kernel[k]);
+
+        plan->execute(X.data(), y.data());
+
+        std::copy(y.end() - block, y.end(), out);
+    }
+
+    /**
+     *  Filters the next block of the signal.
+     *
+     *  @param in the next block_size() samples of the signal.
+     *  @return the block_size() filtered samples.
+     */
+
+    std::vector<T> process(const std::vector<T> &in) {
+        assert(in.size() == block);
+
+        std::vector<T> out(block);
+
+        process(in.data(), out.data());
+
+        return out;
+    }
+
+    /**
+     *  Forgets the signal seen so far, as if the convolver had just been constructed.
+     */
+
+    void reset() {
+        std::fill(window.begin(), window.end(), T(0));
+    }
+};
+
+/**
+ * A streaming convolver for long kernels at low latency, using uniformly partitioned overlap-save.
+ *
+ * The kernel is split into partitions of block_size() taps, and the spectrum of each partition is computed once, in the constructor.
+ * Each block of the signal is transformed once, with the block before it, and its spectrum is pushed onto a frequency-domain delay line.
+ * The output spectrum is the sum of each spectrum on the delay line times the partition of the same age, so a kernel of any length costs one forward and one inverse transform of 2 block_size() points per block, plus one multiply-add per partition and frequency.
+ * The latency is one block, independent of the length of the kernel.
+ *
+ * A partitioned_convolver holds the delay line between calls, so each instance must only be used by one thread at a time.
+ *
+ * @param T the floating point type of the signal.
+ */
+
+template <typename T = double>
+class partitioned_convolver {
+
+    private:
+
+    size_t block, partitions, head;
+
+    std::shared_ptr<const rfft_plan<T>> plan;
+
+    // The spectra of the partitions of the kernel, and the delay line of the spectra of the input blocks, block + 1 values each.
+    // The newest input spectrum is at index head of the delay line, and older ones follow it, wrapping around.
+
+    std::vector<std::complex<T>> kernel, delay;
+
+    std::vector<T> window, y;
+
+    std::vector<std::complex<T>> Y;
+
+    public:
+
+    /**
+     *  Constructs a partitioned convolver for a kernel.
+     *
+     *  @param h the kernel, which must not be empty.
+     *  @param block the number of samples per block, which is also the latency. Powers of two are fastest.
+     *  @throws std::invalid_argument if h is empty or block is 0.
+     */
+
+    partitioned_convolver(const std::vector<T> &h, size_t block): block(block), partitions(0), head(0) {
+        if(h.empty() || block == 0) throw std::invalid_argument("partitioned_convolver: the kernel must not be empty and the block size must be positive");
+
+        partitions = (h.size() + block - 1) / block;
+
+        size_t N = 2 * block, bins = block + 1;
+
+        plan = std::make_shared<const rfft_plan<T>>(N);
+
+        kernel.resize(partitions * bins);
+
+        std::vector<T> part(N);
+        for(size_t p = 0; p < partitions; ++ p) {
+            std::fill(part.begin(), part.end(), T(0));
+            std::copy(h.begin() + p * block, h.begin() + std::min(h.size(), (p + 1) * block), part.begin());
+            plan->execute(part.data(), kernel.data() + p * bins);
+        }
+
+        delay.assign(partitions * bins, std::complex<T>());
+        window.assign(N, T(0));
+        y.resize(N);
+        Y.resize(bins);
+    }
+
+    /**
+     *  Retrieves the number of samples consumed and produced by each call to process.
+     *
+     *  @return the block size.
+     */
+
+    inline size_t block_size() const {
+        return block;
+    }
+
+    /**
+     *  Filters the next block of the signal.
+     *
+     *  @param in the next block_size() samples of the signal.
+     *  @param out overwritten with the block_size() filtered samples. This may equal in.
+     */
+
+    void process(const T *in, T *out) {
+        size_t bins = block + 1;
+
+        std::copy(window.begin() + block, window.end(), window.begin());
+        std::copy(in, in + block, window.begin() + block);
+
+        head = (head + partitions - 1) % partitions;
+        plan->execute(window.data(), delay.data() + head * bins);
+
+        std::fill(Y.begin(), Y.end(), std::complex<T>());
+
+        for(size_t p = 0; p < partitions; ++ p) {
+            const std::complex<T> *x = delay.data() + (head + p) % partitions * bins, *H = kernel.data() + p * bins;
+            for(size_t k = 0; k < bins; ++ k)
+                Y[k] += fft_detail::cmul(x[k], H[k]);
+        }
+
+        plan->execute(Y.data(), y.data());
+
+        std::copy(y.begin() + block, y.end(), out);
+    }
+
+    /**
+     *  Filters the next block of the signal.
+     *
+     *  @param in the next block_size() samples of the signal.
+     *  @return the block_size() filtered samples.
+     */
+
+    std::vector<T> process(const std::vector<T> &in) {
+        assert(in.size() == block);
+
+        std::vector<T> out(block);
+
+        process(in.data(), out.data());
+
+        return out;
+    }
+
+    /**
+     *  Forgets the signal seen so far, as if the convolver had just been constructed.
+     */
+
+    void reset() {
+        std::fill(window.begin(), window.end(), T(0));
+        std::fill(delay.begin(), delay.end(), std::complex<T>());
+        head = 0;
+    }
+};
+
+#endif
@@ -11,61 +11,1645 @@
 #define FFT_H
 
 #include <algorithm>
+#include <cassert>
 #include <cmath>
 #include <complex>
+#include <map>
+#include <memory>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "thread_pool.h"
+
+#if !defined(FFT_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define FFT_X86_SIMD
+#include <immintrin.h>
+#endif
+
 /**
- * An iterative implementation of the Fast Fourier Transform.
- *
- * @param P an std::vector of std::complex<long double> representing the values to compute the FFT of. Note that this vector will be overwritten with the values returned by the FFT.
- * @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+ * Internal helpers for fft.h. Nothing in this namespace is part of the interface.
  */
 
-void FFT(std::vector<std::complex<long double>> &P, int inv = 1) {
-    static std::vector<std::complex<long double>> roots;
+namespace fft_detail {
 
-    size_t length = 1;
+    /**
+     *  The signature of a butterfly kernel. A kernel computes one radix-2 stage over all blocks of P.
+     *
+     *  @param P the values being transformed.
+     *  @param N the length of P.
+     *  @param h half the block length of the stage.
+     *  @param w the h twiddle factors of the stage, stored contiguously.
+     */
 
-    while(length < P.size()) length <<= 1;
+    template <typename T>
+    using butterfly_kernel = void (*)(std::complex<T> *P, size_t N, size_t h, const std::complex<T> *w);
 
-    P.resize(length);
+    /**
+     *  The signature of a radix-4 kernel. A kernel combines four transforms of length m into one of length 4m, for all blocks of P.
+     *
+     *  @param P the values being transformed.
+     *  @param N the length of P.
+     *  @param m a quarter of the block length of the stage.
+     *  @param w the 3m twiddle factors of the stage: m powers each of W, W^2 and W^3, stored one after the other.
+     *  @param inv 1 for the forward transform and -1 for the inverse transform.
+     */
 
-    for(size_t i = 1, j = 0; i < P.size(); ++ i) {
-        int b = P.size() >> 1;
-        while(j >= b) {
-            j -= b;
-            b >>= 1;
-        }
-        if(i < j) std::swap(P[i], P[j]);
+    template <typename T>
+    using radix4_kernel = void (*)(std::complex<T> *P, size_t N, size_t m, const std::complex<T> *w, int inv);
+
+    /**
+     *  Multiplies two complex numbers.
+     *
+     *  std::complex's operator * has to handle infinities and NaNs, which prevents the compiler from inlining or vectorizing it.
+     *
+     *  @param a the first factor.
+     *  @param b the second factor.
+     *  @return a * b.
+     */
+
+    template <typename T>
+    inline std::complex<T> cmul(const std::complex<T> &a, const std::complex<T> &b) {
+        return std::complex<T>(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
     }
 
-    long double theta = inv * 2 * M_PI / P.size();
+    /**
+     *  Multiplies a complex number by i.
+     *
+     *  @param a the complex number.
+     *  @return i * a.
+     */
 
-    if(roots.size() != P.size() / 2) {
-        roots.clear();
-        roots.resize(P.size());
-        for(size_t i=0; i < P.size() / 2; ++ i)
-            roots[i] = std::complex<long double> (cos(theta * i), sin(theta * i));
+    template <typename T>
+    inline std::complex<T> muli(const std::complex<T> &a) {
+        return std::complex<T>(-a.imag(), a.real());
     }
 
-    for(size_t i = 2; i <= P.size(); i <<= 1) {
-        int layer = P.size() / i;
-        for(size_t j = 0; j < P.size(); j += i) {
-            for(size_t k = 0; k < i / 2; ++ k) {
+    /**
+     *  Portable butterfly kernel, used for long double and for stages too short to fill a vector register.
+     */
+
+    template <typename T>
+    void butterfly_scalar(std::complex<T> *P, size_t N, size_t h, const std::complex<T> *w) {
+        for(size_t j = 0; j < N; j += 2 * h) {
+            for(size_t k = 0; k < h; ++ k) {
                 auto u = P[j + k];
-                auto v = P[j + k + i / 2] * roots[layer * k];
+                auto v = cmul(P[j + k + h], w[k]);
                 P[j + k] = u + v;
-                P[j + k + i / 2] = u - v;
+                P[j + k + h] = u - v;
+            }
+        }
+    }
+
+    /**
+     *  Portable radix-4 kernel.
+     *
+     *  The input of each block is in bit-reversed order, so its four quarters hold the transforms of the elements congruent to 0, 2, 1 and 3 (mod 4), in that order.
+     */
+
+    template <typename T>
+    void radix4_scalar(std::complex<T> *P, size_t N, size_t m, const std::complex<T> *w, int inv) {
+        for(size_t j = 0; j < N; j += 4 * m) {
+            for(size_t k = 0; k < m; ++ k) {
+                auto a0 = P[j + k];
+                auto a2 = cmul(P[j + k + m], w[m + k]);
+                auto a1 = cmul(P[j + k + 2 * m], w[k]);
+                auto a3 = cmul(P[j + k + 3 * m], w[2 * m + k]);
+                auto s = a0 + a2, d = a0 - a2;
+                auto t = a1 + a3, u = inv == -1 ? muli(a3 - a1) : muli(a1 - a3);
+                P[j + k] = s + t;
+                P[j + k + m] = d + u;
+                P[j + k + 2 * m] = s - t;
+                P[j + k + 3 * m] = d - u;
+            }
+        }
+    }
+
+    /**
+     *  Transposes a row-major matrix into another, in blocks small enough that both the rows read and the rows written stay in cache.
+     *
+     *  @param in the rows x columns matrix to transpose.
+     *  @param out overwritten with the columns x rows transpose. This must not overlap in.
+     *  @param rows the number of rows of in.
+     *  @param columns the number of columns of in.
+     *  @param first the first row of in to transpose. Disjoint ranges of rows can be transposed concurrently.
+     *  @param last one past the last row of in to transpose.
+     */
+
+    template <typename C>
+    void transpose(const C *in, C *out, size_t rows, size_t columns, size_t first = 0, size_t last = size_t(-1)) {
+        const size_t B = 16;
+        last = std::min(last, rows);
+        for(size_t i0 = first; i0 < last; i0 += B) {
+            for(size_t j0 = 0; j0 < columns; j0 += B) {
+                for(size_t i = i0; i < std::min(i0 + B, last); ++ i)
+                    for(size_t j = j0; j < std::min(j0 + B, columns); ++ j)
+                        out[j * rows + i] = in[i * columns + j];
+            }
+        }
+    }
+
+    /**
+     *  Splits the range [0, count) into contiguous chunks and calls f(begin, end) on each chunk, at most threads at a time.
+     *
+     *  The chunks are tasks on the shared thread pool, so no thread is created per call. Called from inside a chunk, the inner chunks run on the calling thread.
+     *  Only when the pool is busy with another thread's job, such as a transform started from another thread, are threads created for the chunks instead.
+     *
+     *  @param count the size of the range.
+     *  @param threads the number of threads to use, including the calling thread.
+     *  @param f the function to call on each chunk.
+     */
+
+    template <typename F>
+    void parallel_for(size_t count, unsigned threads, const F &f) {
+        size_t chunks = std::min<size_t>(threads, count);
+
+        if(chunks <= 1) {
+            f(0, count);
+            return;
+        }
+
+        if(thread_pool::shared().run(chunks, [&](size_t t) { f(count * t / chunks, count * (t + 1) / chunks); }))
+            return;
+
+        std::vector<std::thread> workers;
+        for(size_t t = 1; t < chunks; ++ t)
+            workers.emplace_back(f, count * t / chunks, count * (t + 1) / chunks);
+
+        f(0, count / chunks);
+
+        for(auto &w: workers)
+            w.join();
+    }
+
+    /**
+     *  Pi to the precision of long double. M_PI is only a double, which would limit long double twiddle factors to double precision.
+     */
+
+    const long double pi = 3.141592653589793238462643383279502884L;
+
+    /**
+     *  Generates the powers of a primitive root of unity, W_N^k = e^(2 pi i k / N), without calling cos and sin for every k.
+     *
+     *  Symmetry reduces every k to the first octant [0, N / 8] when 8 divides N, and to [0, N / 2] otherwise, exactly.
+     *  There, k = hi s + lo with s about the square root of the octant, and W^k = W^(hi s) W^lo is the product of entries of two small tables computed with cosl and sinl.
+     *  The product is formed in long double, so double precision factors come out correctly rounded or within an ulp of it.
+     */
+
+    class unit_roots {
+
+        private:
+
+        size_t n, m, s;
+
+        std::vector<std::complex<long double>> coarse, fine;
+
+        inline std::complex<long double> base(size_t k) const {
+            std::complex<long double> a = coarse[k / s], b = fine[k % s];
+            return std::complex<long double>(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+        }
+
+        /**
+         *  Applies the symmetry that maps k > m back to the reduced range.
+         *
+         *  @param k the exponent, in (m, N).
+         *  @param w the value of W at the exponent returned by reduce(k).
+         *  @return W^k.
+         */
+
+        template <typename C>
+        inline C unfold(size_t k, const C &w) const {
+            if(2 * k > n) return std::conj(w);
+            if(n % 4 == 0 && 4 * k > n) return C(-w.imag(), w.real());
+            return C(w.imag(), w.real());
+        }
+
+        inline size_t reduce(size_t k) const {
+            if(2 * k > n) return n - k;
+            if(n % 4 == 0 && 4 * k > n) return k - n / 4;
+            return n / 4 - k;
+        }
+
+        public:
+
+        explicit unit_roots(size_t N): n(N), m(N % 8 == 0 ? N / 8 : N / 2), s(1) {
+            while(s * s < m + 1) ++ s;
+
+            fine.resize(s);
+            coarse.resize(m / s + 1);
+
+            for(size_t i = 0; i < fine.size(); ++ i)
+                fine[i] = std::polar(1.0L, 2 * pi * (long double) i / (long double) N);
+            for(size_t i = 0; i < coarse.size(); ++ i)
+                coarse[i] = std::polar(1.0L, 2 * pi * (long double) (i * s) / (long double) N);
+        }
+
+        /**
+         *  Computes one power of the root.
+         *
+         *  @param k the exponent, in [0, N).
+         *  @return W_N^k.
+         */
+
+        std::complex<long double> operator () (size_t k) const {
+            if(k <= m) return base(k);
+
+            size_t r = reduce(k);
+            return unfold(k, r <= m ? base(r) : (*this)(r));
+        }
+
+        /**
+         *  Computes consecutive powers of the root.
+         *
+         *  @param out the first of count values, overwritten with W_N^k for k in [0, count).
+         *  @param count the number of powers, at most N.
+         */
+
+        template <typename T>
+        void fill(std::complex<T> *out, size_t count) const {
+            size_t first = std::min(count, m + 1);
+
+            for(size_t hi = 0, k = 0; k < first; ++ hi) {
+                std::complex<long double> a = coarse[hi];
+                for(size_t lo = 0; lo < s && k < first; ++ lo, ++ k) {
+                    std::complex<long double> b = fine[lo];
+                    out[k] = std::complex<T>(T(a.real() * b.real() - a.imag() * b.imag()), T(a.real() * b.imag() + a.imag() * b.real()));
+                }
+            }
+
+            // Every reduced exponent is smaller than the exponent it comes from, so it has already been written.
+            for(size_t k = first; k < count; ++ k)
+                out[k] = unfold(k, out[reduce(k)]);
+        }
+    };
+
+#ifdef FFT_X86_SIMD
+
+    // Each register holds complex numbers as interleaved (real, imaginary) pairs.
+    // Products are formed as a * b.real() + swap(a) * b.imag(), with the sign of the second term flipped in the real lanes.
+
+    inline __m128d cmul_sse2(__m128d a, __m128d b) {
+        return _mm_add_pd(_mm_mul_pd(a, _mm_unpacklo_pd(b, b)),
+                _mm_xor_pd(_mm_set_pd(0.0, -0.0), _mm_mul_pd(_mm_shuffle_pd(a, a, 1), _mm_unpackhi_pd(b, b))));
+    }
+
+    inline __m128 cmul_sse2(__m128 a, __m128 b) {
+        return _mm_add_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 0, 0))),
+                _mm_xor_ps(_mm_set_ps(0.0f, -0.0f, 0.0f, -0.0f), _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 1, 1)))));
+    }
+
+    inline __m128d muli_sse2(__m128d a) {
+        return _mm_xor_pd(_mm_set_pd(0.0, -0.0), _mm_shuffle_pd(a, a, 1));
+    }
+
+    inline __m128 muli_sse2(__m128 a) {
+        return _mm_xor_ps(_mm_set_ps(0.0f, -0.0f, 0.0f, -0.0f), _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)));
+    }
+
+    __attribute__((target("avx2,fma")))
+    inline __m256d cmul_avx2(__m256d a, __m256d b) {
+        return _mm256_fmaddsub_pd(a, _mm256_movedup_pd(b), _mm256_mul_pd(_mm256_permute_pd(a, 0x5), _mm256_permute_pd(b, 0xF)));
+    }
+
+    __attribute__((target("avx2,fma")))
+    inline __m256 cmul_avx2(__m256 a, __m256 b) {
+        return _mm256_fmaddsub_ps(a, _mm256_moveldup_ps(b), _mm256_mul_ps(_mm256_permute_ps(a, 0xB1), _mm256_movehdup_ps(b)));
+    }
+
+    __attribute__((target("avx2,fma")))
+    inline __m256d muli_avx2(__m256d a) {
+        return _mm256_addsub_pd(_mm256_setzero_pd(), _mm256_permute_pd(a, 0x5));
+    }
+
+    __attribute__((target("avx2,fma")))
+    inline __m256 muli_avx2(__m256 a) {
+        return _mm256_addsub_ps(_mm256_setzero_ps(), _mm256_permute_ps(a, 0xB1));
+    }
+
+    // The AVX-512 shuffles are spelled with _mm512_shuffle_*, since GCC's _mm512_permute_* and _mm512_move*dup_* trip -Wmaybe-uninitialized.
+
+    __attribute__((target("avx512f")))
+    inline __m512d cmul_avx512(__m512d a, __m512d b) {
+        return _mm512_fmaddsub_pd(a, _mm512_shuffle_pd(b, b, 0x00), _mm512_mul_pd(_mm512_shuffle_pd(a, a, 0x55), _mm512_shuffle_pd(b, b, 0xFF)));
+    }
+
+    __attribute__((target("avx512f")))
+    inline __m512 cmul_avx512(__m512 a, __m512 b) {
+        return _mm512_fmaddsub_ps(a, _mm512_shuffle_ps(b, b, 0xA0), _mm512_mul_ps(_mm512_shuffle_ps(a, a, 0xB1), _mm512_shuffle_ps(b, b, 0xF5)));
+    }
+
+    __attribute__((target("avx512f")))
+    inline __m512d muli_avx512(__m512d a) {
+        __m512d s = _mm512_shuffle_pd(a, a, 0x55);
+        return _mm512_mask_sub_pd(s, 0x55, _mm512_setzero_pd(), s);
+    }
+
+    __attribute__((target("avx512f")))
+    inline __m512 muli_avx512(__m512 a) {
+        __m512 s = _mm512_shuffle_ps(a, a, 0xB1);
+        return _mm512_mask_sub_ps(s, 0x5555, _mm512_setzero_ps(), s);
+    }
+
+    inline void butterfly_sse2(std::complex<double> *P, size_t N, size_t h, const std::complex<double> *w) {
+        double *p = reinterpret_cast<double *>(P);
+        const double *q = reinterpret_cast<const double *>(w);
+        for(size_t j = 0; j < 2 * N; j += 4 * h) {
+            for(size_t k = 0; k < 2 * h; k += 2) {
+                __m128d u = _mm_loadu_pd(p + j + k);
+                __m128d v = cmul_sse2(_mm_loadu_pd(p + j + k + 2 * h), _mm_loadu_pd(q + k));
+                _mm_storeu_pd(p + j + k, _mm_add_pd(u, v));
+                _mm_storeu_pd(p + j + k + 2 * h, _mm_sub_pd(u, v));
+            }
+        }
+    }
+
+    inline void butterfly_sse2(std::complex<float> *P, size_t N, size_t h, const std::complex<float> *w) {
+        if(h < 2) return butterfly_scalar(P, N, h, w);
+        float *p = reinterpret_cast<float *>(P);
+        const float *q = reinterpret_cast<const float *>(w);
+        for(size_t j = 0; j < 2 * N; j += 4 * h) {
+            for(size_t k = 0; k < 2 * h; k += 4) {
+                __m128 u = _mm_loadu_ps(p + j + k);
+                __m128 v = cmul_sse2(_mm_loadu_ps(p + j + k + 2 * h), _mm_loadu_ps(q + k));
+                _mm_storeu_ps(p + j + k, _mm_add_ps(u, v));
+                _mm_storeu_ps(p + j + k + 2 * h, _mm_sub_ps(u, v));
+            }
+        }
+    }
+
+    __attribute__((target("avx2,fma")))
+    inline void butterfly_avx2(std::complex<double> *P, size_t N, size_t h, const std::complex<double> *w) {
+        if(h < 2) return butterfly_sse2(P, N, h, w);
+        double *p = reinterpret_cast<double *>(P);
+        const double *q = reinterpret_cast<const double *>(w);
+        for(size_t j = 0; j < 2 * N; j += 4 * h) {
+            for(size_t k = 0; k < 2 * h; k += 4) {
+                __m256d u = _mm256_loadu_pd(p + j + k);
+                __m256d v = cmul_avx2(_mm256_loadu_pd(p + j + k + 2 * h), _mm256_loadu_pd(q + k));
+                _mm256_storeu_pd(p + j + k, _mm256_add_pd(u, v));
+                _mm256_storeu_pd(p + j + k + 2 * h, _mm256_sub_pd(u, v));
+            }
+        }
+    }
+
+    __attribute__((target("avx2,fma")))
+    inline void butterfly_avx2(std::complex<float> *P, size_t N, size_t h, const std::complex<float> *w) {
+        if(h < 4) return butterfly_sse2(P, N, h, w);
+        float *p = reinterpret_cast<float *>(P);
+        const float *q = reinterpret_cast<const float *>(w);
+        for(size_t j = 0; j < 2 * N; j += 4 * h) {
+            for(size_t k = 0; k < 2 * h; k += 8) {
+                __m256 u = _mm256_loadu_ps(p + j + k);
+                __m256 v = cmul_avx2(_mm256_loadu_ps(p + j + k + 2 * h), _mm256_loadu_ps(q + k));
+                _mm256_storeu_ps(p + j + k, _mm256_add_ps(u, v));
+                _mm256_storeu_ps(p + j + k + 2 * h, _mm256_sub_ps(u, v));
+            }
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    inline void butterfly_avx512(std::complex<double> *P, size_t N, size_t h, const std::complex<double> *w) {
+        if(h < 4) return butterfly_sse2(P, N, h, w);
+        double *p = reinterpret_cast<double *>(P);
+        const double *q = reinterpret_cast<const double *>(w);
+        for(size_t j = 0; j < 2 * N; j += 4 * h) {
+            for(size_t k = 0; k < 2 * h; k += 8) {
+                __m512d u = _mm512_loadu_pd(p + j + k);
+                __m512d v = cmul_avx512(_mm512_loadu_pd(p + j + k + 2 * h), _mm512_loadu_pd(q + k));
+                _mm512_storeu_pd(p + j + k, _mm512_add_pd(u, v));
+                _mm512_storeu_pd(p + j + k + 2 * h, _mm512_sub_pd(u, v));
+            }
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    inline void butterfly_avx512(std::complex<float> *P, size_t N, size_t h, const std::complex<float> *w) {
+        if(h < 8) return butterfly_sse2(P, N, h, w);
+        float *p = reinterpret_cast<float *>(P);
+        const float *q = reinterpret_cast<const float *>(w);
+        for(size_t j = 0; j < 2 * N; j += 4 * h) {
+            for(size_t k = 0; k < 2 * h; k += 16) {
+                __m512 u = _mm512_loadu_ps(p + j + k);
+                __m512 v = cmul_avx512(_mm512_loadu_ps(p + j + k + 2 * h), _mm512_loadu_ps(q + k));
+                _mm512_storeu_ps(p + j + k, _mm512_add_ps(u, v));
+                _mm512_storeu_ps(p + j + k + 2 * h, _mm512_sub_ps(u, v));
+            }
+        }
+    }
+
+    // The radix-4 kernels index in units of T rather than complex numbers, so every offset is doubled.
+
+    inline void radix4_sse2(std::complex<double> *P, size_t N, size_t m, const std::complex<double> *w, int inv) {
+        double *p = reinterpret_cast<double *>(P);
+        const double *q = reinterpret_cast<const double *>(w);
+        for(size_t j = 0; j < 2 * N; j += 8 * m) {
+            for(size_t k = 0; k < 2 * m; k += 2) {
+                __m128d a0 = _mm_loadu_pd(p + j + k);
+                __m128d a2 = cmul_sse2(_mm_loadu_pd(p + j + k + 2 * m), _mm_loadu_pd(q + 2 * m + k));
+                __m128d a1 = cmul_sse2(_mm_loadu_pd(p + j + k + 4 * m), _mm_loadu_pd(q + k));
+                __m128d a3 = cmul_sse2(_mm_loadu_pd(p + j + k + 6 * m), _mm_loadu_pd(q + 4 * m + k));
+                __m128d s = _mm_add_pd(a0, a2), d = _mm_sub_pd(a0, a2);
+                __m128d t = _mm_add_pd(a1, a3), u = muli_sse2(inv == -1 ? _mm_sub_pd(a3, a1) : _mm_sub_pd(a1, a3));
+                _mm_storeu_pd(p + j + k, _mm_add_pd(s, t));
+                _mm_storeu_pd(p + j + k + 2 * m, _mm_add_pd(d, u));
+                _mm_storeu_pd(p + j + k + 4 * m, _mm_sub_pd(s, t));
+                _mm_storeu_pd(p + j + k + 6 * m, _mm_sub_pd(d, u));
+            }
+        }
+    }
+
+    inline void radix4_sse2(std::complex<float> *P, size_t N, size_t m, const std::complex<float> *w, int inv) {
+        if(m < 2) return radix4_scalar(P, N, m, w, inv);
+        float *p = reinterpret_cast<float *>(P);
+        const float *q = reinterpret_cast<const float *>(w);
+        for(size_t j = 0; j < 2 * N; j += 8 * m) {
+            for(size_t k = 0; k < 2 * m; k += 4) {
+                __m128 a0 = _mm_loadu_ps(p + j + k);
+                __m128 a2 = cmul_sse2(_mm_loadu_ps(p + j + k + 2 * m), _mm_loadu_ps(q + 2 * m + k));
+                __m128 a1 = cmul_sse2(_mm_loadu_ps(p + j + k + 4 * m), _mm_loadu_ps(q + k));
+                __m128 a3 = cmul_sse2(_mm_loadu_ps(p + j + k + 6 * m), _mm_loadu_ps(q + 4 * m + k));
+                __m128 s = _mm_add_ps(a0, a2), d = _mm_sub_ps(a0, a2);
+                __m128 t = _mm_add_ps(a1, a3), u = muli_sse2(inv == -1 ? _mm_sub_ps(a3, a1) : _mm_sub_ps(a1, a3));
+                _mm_storeu_ps(p + j + k, _mm_add_ps(s, t));
+                _mm_storeu_ps(p + j + k + 2 * m, _mm_add_ps(d, u));
+                _mm_storeu_ps(p + j + k + 4 * m, _mm_sub_ps(s, t));
+                _mm_storeu_ps(p + j + k + 6 * m, _mm_sub_ps(d, u));
+            }
+        }
+    }
+
+    __attribute__((target("avx2,fma")))
+    inline void radix4_avx2(std::complex<double> *P, size_t N, size_t m, const std::complex<double> *w, int inv) {
+        if(m < 2) return radix4_sse2(P, N, m, w, inv);
+        double *p = reinterpret_cast<double *>(P);
+        const double *q = reinterpret_cast<const double *>(w);
+        for(size_t j = 0; j < 2 * N; j += 8 * m) {
+            for(size_t k = 0; k < 2 * m; k += 4) {
+                __m256d a0 = _mm256_loadu_pd(p + j + k);
+                __m256d a2 = cmul_avx2(_mm256_loadu_pd(p + j + k + 2 * m), _mm256_loadu_pd(q + 2 * m + k));
+                __m256d a1 = cmul_avx2(_mm256_loadu_pd(p + j + k + 4 * m), _mm256_loadu_pd(q + k));
+                __m256d a3 = cmul_avx2(_mm256_loadu_pd(p + j + k + 6 * m), _mm256_loadu_pd(q + 4 * m + k));
+                __m256d s = _mm256_add_pd(a0, a2), d = _mm256_sub_pd(a0, a2);
+                __m256d t = _mm256_add_pd(a1, a3), u = muli_avx2(inv == -1 ? _mm256_sub_pd(a3, a1) : _mm256_sub_pd(a1, a3));
+                _mm256_storeu_pd(p + j + k, _mm256_add_pd(s, t));
+                _mm256_storeu_pd(p + j + k + 2 * m, _mm256_add_pd(d, u));
+                _mm256_storeu_pd(p + j + k + 4 * m, _mm256_sub_pd(s, t));
+                _mm256_storeu_pd(p + j + k + 6 * m, _mm256_sub_pd(d, u));
+            }
+        }
+    }
+
+    __attribute__((target("avx2,fma")))
+    inline void radix4_avx2(std::complex<float> *P, size_t N, size_t m, const std::complex<float> *w, int inv) {
+        if(m < 4) return radix4_sse2(P, N, m, w, inv);
+        float *p = reinterpret_cast<float *>(P);
+        const float *q = reinterpret_cast<const float *>(w);
+        for(size_t j = 0; j < 2 * N; j += 8 * m) {
+            for(size_t k = 0; k < 2 * m; k += 8) {
+                __m256 a0 = _mm256_loadu_ps(p + j + k);
+                __m256 a2 = cmul_avx2(_mm256_loadu_ps(p + j + k + 2 * m), _mm256_loadu_ps(q + 2 * m + k));
+                __m256 a1 = cmul_avx2(_mm256_loadu_ps(p + j + k + 4 * m), _mm256_loadu_ps(q + k));
+                __m256 a3 = cmul_avx2(_mm256_loadu_ps(p + j + k + 6 * m), _mm256_loadu_ps(q + 4 * m + k));
+                __m256 s = _mm256_add_ps(a0, a2), d = _mm256_sub_ps(a0, a2);
+                __m256 t = _mm256_add_ps(a1, a3), u = muli_avx2(inv == -1 ? _mm256_sub_ps(a3, a1) : _mm256_sub_ps(a1, a3));
+                _mm256_storeu_ps(p + j + k, _mm256_add_ps(s, t));
+                _mm256_storeu_ps(p + j + k + 2 * m, _mm256_add_ps(d, u));
+                _mm256_storeu_ps(p + j + k + 4 * m, _mm256_sub_ps(s, t));
+                _mm256_storeu_ps(p + j + k + 6 * m, _mm256_sub_ps(d, u));
+            }
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    inline void radix4_avx512(std::complex<double> *P, size_t N, size_t m, const std::complex<double> *w, int inv) {
+        if(m < 4) return radix4_sse2(P, N, m, w, inv);
+        double *p = reinterpret_cast<double *>(P);
+        const double *q = reinterpret_cast<const double *>(w);
+        for(size_t j = 0; j < 2 * N; j += 8 * m) {
+            for(size_t k = 0; k < 2 * m; k += 8) {
+                __m512d a0 = _mm512_loadu_pd(p + j + k);
+                __m512d a2 = cmul_avx512(_mm512_loadu_pd(p + j + k + 2 * m), _mm512_loadu_pd(q + 2 * m + k));
+                __m512d a1 = cmul_avx512(_mm512_loadu_pd(p + j + k + 4 * m), _mm512_loadu_pd(q + k));
+                __m512d a3 = cmul_avx512(_mm512_loadu_pd(p + j + k + 6 * m), _mm512_loadu_pd(q + 4 * m + k));
+                __m512d s = _mm512_add_pd(a0, a2), d = _mm512_sub_pd(a0, a2);
+                __m512d t = _mm512_add_pd(a1, a3), u = muli_avx512(inv == -1 ? _mm512_sub_pd(a3, a1) : _mm512_sub_pd(a1, a3));
+                _mm512_storeu_pd(p + j + k, _mm512_add_pd(s, t));
+                _mm512_storeu_pd(p + j + k + 2 * m, _mm512_add_pd(d, u));
+                _mm512_storeu_pd(p + j + k + 4 * m, _mm512_sub_pd(s, t));
+                _mm512_storeu_pd(p + j + k + 6 * m, _mm512_sub_pd(d, u));
+            }
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    inline void radix4_avx512(std::complex<float> *P, size_t N, size_t m, const std::complex<float> *w, int inv) {
+        if(m < 8) return radix4_sse2(P, N, m, w, inv);
+        float *p = reinterpret_cast<float *>(P);
+        const float *q = reinterpret_cast<const float *>(w);
+        for(size_t j = 0; j < 2 * N; j += 8 * m) {
+            for(size_t k = 0; k < 2 * m; k += 16) {
+                __m512 a0 = _mm512_loadu_ps(p + j + k);
+                __m512 a2 = cmul_avx512(_mm512_loadu_ps(p + j + k + 2 * m), _mm512_loadu_ps(q + 2 * m + k));
+                __m512 a1 = cmul_avx512(_mm512_loadu_ps(p + j + k + 4 * m), _mm512_loadu_ps(q + k));
+                __m512 a3 = cmul_avx512(_mm512_loadu_ps(p + j + k + 6 * m), _mm512_loadu_ps(q + 4 * m + k));
+                __m512 s = _mm512_add_ps(a0, a2), d = _mm512_sub_ps(a0, a2);
+                __m512 t = _mm512_add_ps(a1, a3), u = muli_avx512(inv == -1 ? _mm512_sub_ps(a3, a1) : _mm512_sub_ps(a1, a3));
+                _mm512_storeu_ps(p + j + k, _mm512_add_ps(s, t));
+                _mm512_storeu_ps(p + j + k + 2 * m, _mm512_add_ps(d, u));
+                _mm512_storeu_ps(p + j + k + 4 * m, _mm512_sub_ps(s, t));
+                _mm512_storeu_ps(p + j + k + 6 * m, _mm512_sub_ps(d, u));
+            }
+        }
+    }
+
+    /**
+     *  Identifies the widest instruction set supported by the running CPU.
+     *
+     *  @return 2 for AVX-512, 1 for AVX2 with FMA, and 0 for SSE2.
+     */
+
+    inline int simd_level() {
+        static const int level = []() {
+            __builtin_cpu_init();
+            if(__builtin_cpu_supports("avx512f")) return 2;
+            if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return 1;
+            return 0;
+        }();
+        return level;
+    }
+
+    /**
+     *  Picks the widest butterfly kernel supported by the running CPU.
+     *
+     *  @return the selected kernel.
+     */
+
+    template <typename T>
+    inline butterfly_kernel<T> select_butterfly() {
+        switch(simd_level()) {
+            case 2: return butterfly_avx512;
+            case 1: return butterfly_avx2;
+            default: return butterfly_sse2;
+        }
+    }
+
+    template <>
+    inline butterfly_kernel<long double> select_butterfly<long double>() {
+        return butterfly_scalar<long double>;
+    }
+
+    /**
+     *  Picks the widest radix-4 kernel supported by the running CPU.
+     *
+     *  @return the selected kernel.
+     */
+
+    template <typename T>
+    inline radix4_kernel<T> select_radix4() {
+        switch(simd_level()) {
+            case 2: return radix4_avx512;
+            case 1: return radix4_avx2;
+            default: return radix4_sse2;
+        }
+    }
+
+    template <>
+    inline radix4_kernel<long double> select_radix4<long double>() {
+        return radix4_scalar<long double>;
+    }
+
+#else
+
+    template <typename T>
+    inline butterfly_kernel<T> select_butterfly() {
+        return butterfly_scalar<T>;
+    }
+
+    template <typename T>
+    inline radix4_kernel<T> select_radix4() {
+        return radix4_scalar<T>;
+    }
+
+#endif
+
+}
+
+/**
+ * The butterfly used for the stages of a power of two transform.
+ *
+ * radix_2 makes log2(N) passes over the data. radix_4 fuses pairs of stages into one pass, halving the number of passes and saving a quarter of the complex multiplications.
+ */
+
+enum class fft_radix {
+    radix_2,
+    radix_4
+};
+
+/**
+ * A precomputed plan for the Fast Fourier Transform of a fixed size.
+ *
+ * The twiddle factors and the bit-reversal permutation are computed once, when the plan is constructed.
+ * Both the forward and the inverse transform are executed from the same plan, so a plan can be reused across any number of calls.
+ * A plan is never modified after construction, so a single plan may be shared by any number of threads executing transforms concurrently.
+ *
+ * Any length is supported, without padding. Powers of two use the iterative radix-2/radix-4 transform.
+ * Lengths whose prime factors are all at most 7 use a mixed-radix transform, and all other lengths use Bluestein's algorithm on top of a power of two plan.
+ * Powers of two too large to fit in cache use Bailey's six-step algorithm, which only ever transforms rows about sqrt(N) long.
+ * The independent rows of the six-step algorithm can be spread over several threads.
+ *
+ * Besides std::vector, every transform accepts raw pointers to caller-owned memory, so data in ring buffers, mapped files or pinned buffers needs no copying.
+ * The SIMD kernels use unaligned loads, so any std::complex<T> array is accepted. Aligning the data to 32 bytes (AVX2) or 64 bytes (AVX-512) avoids loads that split cache lines.
+ *
+ * @param T the floating point type of the real and imaginary parts. float and double halve and quarter the memory traffic of long double, and can be vectorized.
+ */
+
+template <typename T = long double>
+class fft_plan {
+
+    private:
+
+    size_t n;
+
+    std::vector<size_t> rev;
+
+    // The twiddle factors of the stage with half-length h are stored contiguously at roots[h .. 2h).
+    // Separate tables are kept for each direction, so that the kernels never conjugate on the fly.
+
+    std::vector<std::complex<T>> roots, iroots;
+
+    // The twiddle factors of the radix-4 stages, three blocks of m per stage, in the order the stages are executed.
+
+    std::vector<std::complex<T>> quads, iquads;
+
+    fft_radix radix;
+
+    fft_detail::butterfly_kernel<T> butterfly;
+
+    fft_detail::radix4_kernel<T> radix4;
+
+    // Mixed-radix lengths: the radices, outermost first. roots and iroots then hold all n powers of the primitive n-th root of unity.
+
+    std::vector<size_t> factors;
+
+    // Bluestein lengths: the chirp e^(i pi j^2 / n), the transforms of the convolution kernel for each direction, and the power of two plan used for the convolution.
+
+    std::vector<std::complex<T>> chirp, kernel, ikernel;
+
+    std::shared_ptr<const fft_plan<T>> inner;
+
+    // Six-step lengths: n = n1 n2, the plans for the n1 columns of length n2 and the n2 rows of length n1, and the twiddle factors.
+    // W^(j1 k2) is split as W_n1^hi W^lo with j1 k2 = hi n2 + lo, so only n1 + n2 of them are stored.
+
+    size_t n1, n2;
+
+    std::shared_ptr<const fft_plan<T>> rows, columns;
+
+    std::vector<std::complex<T>> coarse, fine;
+
+    unsigned threads;
+
+    /**
+     *  Computes the quarter block length of the first radix-4 stage.
+     *
+     *  @return 1 if log2(N) is even, and 2 if it is odd.
+     */
+
+    inline size_t first_radix4_stage() const {
+        size_t h = 1;
+        while(4 * h <= size()) h *= 4;
+        return h == size() ? 1 : 2;
+    }
+
+    /**
+     *  Computes the transform of a large power of two length with the six-step algorithm.
+     *
+     *  Viewing P as n2 rows of n1, and writing j = j1 + n1 j2 and k = k2 + n2 k1, the transform is X[k] = sum over j1 of W^(j1 k2) W_n1^(j1 k1) (sum over j2 of P[j] W_n2^(j2 k2)).
+     *  The inner sums are transforms of the columns of in, which are gathered a few at a time into contiguous rows, transformed, twiddled and written to P.
+     *  The outer sums are transforms of the rows of P, which are then transposed into place.
+     *  The sub-plans scale by 1 / n2 and 1 / n1 for the inverse, so the result needs no further scaling.
+     */
+
+    void transform_six_step(const std::complex<T> *in, std::complex<T> *P, int inv) const {
+        // Enough columns to use whole cache lines when gathering them.
+        const size_t B = 8;
+
+        fft_detail::parallel_for(n1 / B, threads, [&](size_t first, size_t last) {
+            std::vector<std::complex<T>> S(B * n2);
+
+            for(size_t j0 = first * B; j0 < last * B; j0 += B) {
+                for(size_t j2 = 0; j2 < n2; ++ j2)
+                    for(size_t b = 0; b < B; ++ b)
+                        S[b * n2 + j2] = in[j2 * n1 + j0 + b];
+
+                for(size_t b = 0; b < B; ++ b) {
+                    std::complex<T> *column = S.data() + b * n2;
+                    columns->transform(column, column, inv);
+                    for(size_t k2 = 1, hi = 0, lo = j0 + b; k2 < n2; ++ k2) {
+                        std::complex<T> w = fft_detail::cmul(coarse[hi], fine[lo]);
+                        column[k2] = fft_detail::cmul(column[k2], inv == -1 ? std::conj(w) : w);
+                        lo += j0 + b;
+                        if(lo >= n2) {
+                            lo -= n2;
+                            ++ hi;
+                        }
+                    }
+                }
+
+                for(size_t j2 = 0; j2 < n2; ++ j2)
+                    for(size_t b = 0; b < B; ++ b)
+                        P[j2 * n1 + j0 + b] = S[b * n2 + j2];
+            }
+        });
+
+        std::vector<std::complex<T>> S(n);
+
+        fft_detail::parallel_for(n2, threads, [&](size_t first, size_t last) {
+            for(size_t k2 = first; k2 < last; ++ k2)
+                rows->transform(P + k2 * n1, P + k2 * n1, inv);
+            fft_detail::transpose(P, S.data(), n2, n1, first, last);
+        });
+
+        fft_detail::parallel_for(n, threads, [&](size_t first, size_t last) {
+            std::copy(S.begin() + first, S.begin() + last, P + first);
+        });
+    }
+
+    /**
+     *  Computes the transform of a power of two length.
+     *
+     *  In place, the input is permuted into bit-reversed order before the first stage.
+     *  Out of place, the first stage reads its inputs straight from their bit-reversed positions, which saves a pass over the data.
+     */
+
+    void transform_pow2(const std::complex<T> *in, std::complex<T> *P, int inv) const {
+        const std::complex<T> *w = inv == -1 ? iroots.data() : roots.data();
+        const std::complex<T> *q = inv == -1 ? iquads.data() : quads.data();
+
+        size_t h = 1;
+
+        if(in == P) {
+            for(size_t i = 1; i < n; ++ i)
+                if(i < rev[i]) std::swap(P[i], P[rev[i]]);
+        } else if(n == 1) {
+            P[0] = in[0];
+        } else if(radix == fft_radix::radix_4 && first_radix4_stage() == 1) {
+            // All the twiddle factors of the first stage are 1.
+            for(size_t j = 0; j < n; j += 4) {
+                auto a0 = in[rev[j]], a2 = in[rev[j + 1]], a1 = in[rev[j + 2]], a3 = in[rev[j + 3]];
+                auto s = a0 + a2, d = a0 - a2;
+                auto t = a1 + a3, u = inv == -1 ? fft_detail::muli(a3 - a1) : fft_detail::muli(a1 - a3);
+                P[j] = s + t;
+                P[j + 1] = d + u;
+                P[j + 2] = s - t;
+                P[j + 3] = d - u;
+            }
+            h = 4;
+            q += 3;
+        } else {
+            for(size_t j = 0; j < n; j += 2) {
+                auto u = in[rev[j]], v = in[rev[j + 1]];
+                P[j] = u + v;
+                P[j + 1] = u - v;
+            }
+            h = 2;
+        }
+
+        if(radix == fft_radix::radix_4) {
+            // An odd number of stages leaves one radix-2 stage, which is cheapest to do first, where its twiddles are all 1.
+            if(h == 1 && first_radix4_stage() == 2) {
+                butterfly(P, n, h, w + h);
+                h = 2;
+            }
+
+            for(; 4 * h <= n; q += 3 * h, h *= 4)
+                radix4(P, n, h, q, inv);
+        }
+
+        for(; h < n; h <<= 1)
+            butterfly(P, n, h, w + h);
+    }
+
+    /**
+     *  Computes the transform of the length m sequence in[0], in[stride], ..., recursively splitting off factors[f].
+     *
+     *  @param in the input sequence.
+     *  @param stride the distance between consecutive elements of the input.
+     *  @param out where the m outputs are written. This must not overlap in.
+     *  @param m the length of the sub-transform, which is the product of factors[f ..].
+     *  @param f the index of the radix to split off.
+     *  @param w the powers of the primitive n-th root of unity for the direction being computed.
+     */
+
+    void transform_mixed(const std::complex<T> *in, size_t stride, std::complex<T> *out, size_t m, size_t f, const std::complex<T> *w) const {
+        if(m == 1) {
+            out[0] = in[0];
+            return;
+        }
+
+        size_t p = factors[f], q = m / p, step = n / m;
+
+        for(size_t r = 0; r < p; ++ r)
+            transform_mixed(in + r * stride, stride * p, out + r * q, q, f + 1, w);
+
+        // X[k + s q] = sum over r of W_m^(r k) Y_r[k] W_p^(r s), where Y_r is the transform of the r-th decimated sequence.
+
+        std::complex<T> y[7];
+
+        for(size_t k = 0; k < q; ++ k) {
+            y[0] = out[k];
+            for(size_t r = 1; r < p; ++ r)
+                y[r] = fft_detail::cmul(out[k + r * q], w[r * k * step]);
+            for(size_t s = 0; s < p; ++ s) {
+                std::complex<T> x = y[0];
+                for(size_t r = 1; r < p; ++ r)
+                    x += fft_detail::cmul(y[r], w[(r * s % p) * (n / p)]);
+                out[k + s * q] = x;
+            }
+        }
+    }
+
+    /**
+     *  Computes the transform of any length with Bluestein's algorithm, as a convolution with the chirp.
+     */
+
+    void transform_bluestein(const std::complex<T> *in, std::complex<T> *P, int inv) const {
+        std::vector<std::complex<T>> a(inner->size());
+
+        for(size_t j = 0; j < n; ++ j)
+            a[j] = fft_detail::cmul(in[j], inv == -1 ? std::conj(chirp[j]) : chirp[j]);
+
+        inner->execute(a, 1);
+
+        const std::vector<std::complex<T>> &b = inv == -1 ? ikernel : kernel;
+        for(size_t i = 0; i < a.size(); ++ i)
+            a[i] = fft_detail::cmul(a[i], b[i]);
+
+        inner->execute(a, -1);
+
+        for(size_t k = 0; k < n; ++ k)
+            P[k] = fft_detail::cmul(a[k], inv == -1 ? std::conj(chirp[k]) : chirp[k]);
+    }
+
+    /**
+     *  Computes the transform of in into P, for any length and direction. in may equal P, but must not otherwise overlap it.
+     */
+
+    void transform(const std::complex<T> *in, std::complex<T> *P, int inv) const {
+        if(rows) {
+            transform_six_step(in, P, inv);
+            return;
+        }
+
+        if(!rev.empty()) {
+            transform_pow2(in, P, inv);
+        } else if(!factors.empty()) {
+            const std::complex<T> *w = inv == -1 ? iroots.data() : roots.data();
+            if(in == P) {
+                std::vector<std::complex<T>> copy(P, P + n);
+                transform_mixed(copy.data(), 1, P, n, 0, w);
+            } else {
+                transform_mixed(in, 1, P, n, 0, w);
+            }
+        } else {
+            transform_bluestein(in, P, inv);
+        }
+
+        if(inv == -1) {
+            for(size_t i = 0; i < n; ++ i) {
+                P[i] /= T(n);
             }
         }
     }
 
-    if(inv == -1) {
-        for(auto & a: P) {
-            a /= P.size();
+    public:
+
+    /**
+     *  The size in bytes above which a power of two transform no longer fits in cache, and the six-step algorithm is used instead.
+     */
+
+    static const size_t six_step_bytes = size_t(1) << 22;
+
+    /**
+     *  Constructs a plan for transforms of length N.
+     *
+     *  @param N the length of the transform.
+     *  @param radix the butterfly used for the stages of a power of two transform.
+     *  @param threads the number of threads a large transform may use, or 0 to use one per hardware thread.
+     */
+
+    explicit fft_plan(size_t N = 1, fft_radix radix = fft_radix::radix_4, unsigned threads = 1): n(N), radix(radix),
+            butterfly(fft_detail::select_butterfly<T>()), radix4(fft_detail::select_radix4<T>()), n1(0), n2(0),
+            threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())) {
+        assert(N > 0);
+
+        if((N & (N - 1)) != 0) {
+            size_t m = N;
+            for(size_t p: {4, 2, 3, 5, 7})
+                while(m % p == 0) {
+                    factors.push_back(p);
+                    m /= p;
+                }
+
+            if(m == 1) {
+                roots.resize(N);
+                iroots.resize(N);
+                fft_detail::unit_roots(N).fill(roots.data(), N);
+                for(size_t i = 0; i < N; ++ i)
+                    iroots[i] = std::conj(roots[i]);
+            } else {
+                factors.clear();
+
+                size_t M = 1;
+                while(M < 2 * N - 1) M <<= 1;
+                inner = std::make_shared<const fft_plan<T>>(M, radix, this->threads);
+
+                // The chirp is W_2N^(j^2), and j^2 is reduced mod 2N first, which keeps the exponent exact.
+                fft_detail::unit_roots W(2 * N);
+                chirp.resize(N);
+                for(size_t j = 0; j < N; ++ j)
+                    chirp[j] = std::complex<T>(W(j * j % (2 * N)));
+
+                kernel.assign(M, std::complex<T>());
+                kernel[0] = std::conj(chirp[0]);
+                for(size_t j = 1; j < N; ++ j)
+                    kernel[j] = kernel[M - j] = std::conj(chirp[j]);
+
+                ikernel.resize(M);
+                for(size_t i = 0; i < M; ++ i)
+                    ikernel[i] = std::conj(kernel[i]);
+
+                inner->execute(kernel, 1);
+                inner->execute(ikernel, 1);
+            }
+
+            return;
+        }
+
+        if(N * sizeof(std::complex<T>) > six_step_bytes) {
+            n1 = 1;
+            while(n1 * n1 * 4 <= N) n1 <<= 1;
+            n2 = N / n1;
+
+            columns = std::make_shared<const fft_plan<T>>(n2, radix);
+            rows = n1 == n2 ? columns : std::make_shared<const fft_plan<T>>(n1, radix);
+
+            coarse.resize(n1);
+            fft_detail::unit_roots(n1).fill(coarse.data(), n1);
+
+            fine.resize(n2);
+            fft_detail::unit_roots(N).fill(fine.data(), n2);
+
+            return;
+        }
+
+        rev.resize(N);
+        roots.resize(N);
+        iroots.resize(N);
+
+        for(size_t i = 1, j = 0; i < N; ++ i) {
+            size_t b = N >> 1;
+            while(j >= b) {
+                j -= b;
+                b >>= 1;
+            }
+            j += b;
+            rev[i] = j;
+        }
+
+        fft_detail::unit_roots(N).fill(roots.data() + N / 2, N / 2);
+
+        for(size_t h = N / 4; h > 0; h >>= 1)
+            for(size_t i = 0; i < h; ++ i)
+                roots[h + i] = roots[2 * h + 2 * i];
+
+        for(size_t i = 1; i < N; ++ i)
+            iroots[i] = std::conj(roots[i]);
+
+        if(radix == fft_radix::radix_4) {
+            // W = roots[2m + k] is a primitive 4m-th root of unity, and W^2 and W^3 come from the tables of the smaller stages.
+            for(size_t m = first_radix4_stage(); 4 * m <= N; m *= 4) {
+                for(size_t k = 0; k < m; ++ k) quads.push_back(roots[2 * m + k]);
+                for(size_t k = 0; k < m; ++ k) quads.push_back(roots[m + k]);
+                for(size_t k = 0; k < m; ++ k) quads.push_back(3 * k < 2 * m ? roots[2 * m + 3 * k] : -roots[3 * k]);
+            }
+            for(auto &w: quads)
+                iquads.push_back(std::conj(w));
         }
     }
+
+    /**
+     *  Retrieves the length of the transforms computed by the plan.
+     *
+     *  @return the length of the transform.
+     */
+
+    inline size_t size() const {
+        return n;
+    }
+
+    /**
+     *  Retrieves the number of threads a large transform may use.
+     *
+     *  @return the number of threads.
+     */
+
+    inline unsigned get_threads() const {
+        return threads;
+    }
+
+    /**
+     *  Retrieves the butterfly used for the stages of the transform.
+     *
+     *  @return the radix of the plan.
+     */
+
+    inline fft_radix get_radix() const {
+        return radix;
+    }
+
+    /**
+     *  Computes the Fast Fourier Transform of P, in place.
+     *
+     *  @param P the values to compute the FFT of. P.size() must equal size().
+     *  @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+     */
+
+    void execute(std::vector<std::complex<T>> &P, int inv = 1) const {
+        assert(P.size() == size());
+
+        transform(P.data(), P.data(), inv);
+    }
+
+    /**
+     *  Computes the Fast Fourier Transform of in, leaving in untouched.
+     *
+     *  Unlike copying in and transforming the copy in place, this avoids both the copy and the separate bit-reversal pass.
+     *
+     *  @param in the values to compute the FFT of. in.size() must equal size().
+     *  @param out overwritten with the transform of in.
+     *  @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+     */
+
+    void execute(const std::vector<std::complex<T>> &in, std::vector<std::complex<T>> &out, int inv = 1) const {
+        assert(in.size() == size());
+
+        out.resize(n);
+
+        transform(in.data(), out.data(), inv);
+    }
+
+    /**
+     *  Computes the Fast Fourier Transform of size() values in caller-owned memory, in place.
+     *
+     *  @param P the first of the size() contiguous values to compute the FFT of.
+     *  @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+     */
+
+    void execute(std::complex<T> *P, int inv = 1) const {
+        transform(P, P, inv);
+    }
+
+    /**
+     *  Computes the Fast Fourier Transform of size() values in caller-owned memory, leaving them untouched.
+     *
+     *  @param in the first of the size() contiguous values to compute the FFT of.
+     *  @param out the first of size() contiguous values overwritten with the transform. This must not overlap in.
+     *  @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+     */
+
+    void execute(const std::complex<T> *in, std::complex<T> *out, int inv = 1) const {
+        transform(in, out, inv);
+    }
+
+    /**
+     *  Computes the Fast Fourier Transform of size() strided values in caller-owned memory.
+     *
+     *  Strided input is gathered into the output when the output is contiguous, and into a temporary buffer otherwise.
+     *
+     *  @param in the first value to compute the FFT of. Value j is in[j * istride].
+     *  @param istride the distance between consecutive input values.
+     *  @param out where the transform is written. Value k is out[k * ostride]. This may equal in when the strides are equal, but must not otherwise overlap it.
+     *  @param ostride the distance between consecutive output values.
+     *  @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+     */
+
+    void execute(const std::complex<T> *in, size_t istride, std::complex<T> *out, size_t ostride, int inv = 1) const {
+        if(istride == 1 && ostride == 1) {
+            transform(in, out, inv);
+            return;
+        }
+
+        if(ostride == 1) {
+            for(size_t j = 0; j < n; ++ j)
+                out[j] = in[j * istride];
+            transform(out, out, inv);
+            return;
+        }
+
+        std::vector<std::complex<T>> buffer(n);
+
+        if(istride == 1) {
+            transform(in, buffer.data(), inv);
+        } else {
+            for(size_t j = 0; j < n; ++ j)
+                buffer[j] = in[j * istride];
+            transform(buffer.data(), buffer.data(), inv);
+        }
+
+        for(size_t k = 0; k < n; ++ k)
+            out[k * ostride] = buffer[k];
+    }
+
+    /**
+     *  Computes the Fast Fourier Transforms of a batch of signals of length size(), in place.
+     *
+     *  Element j of signal i is data[i * dist + j * stride]. Strided signals are gathered into a contiguous buffer, transformed and scattered back.
+     *  The signals are spread over the plan's threads, but each is transformed on its own: unlike FFTW's batched kernels, the same element of several signals is not interleaved into one SIMD register, so a batch of short signals gains no more from SIMD than transforming them one by one.
+     *
+     *  @param data the first element of the first signal.
+     *  @param howmany the number of signals.
+     *  @param stride the distance between consecutive elements of a signal.
+     *  @param dist the distance between the first elements of consecutive signals.
+     *  @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+     */
+
+    void execute_many(std::complex<T> *data, size_t howmany, size_t stride, size_t dist, int inv = 1) const {
+        fft_detail::parallel_for(howmany, rows ? 1 : threads, [&](size_t first, size_t last) {
+            if(stride == 1) {
+                for(size_t i = first; i < last; ++ i)
+                    transform(data + i * dist, data + i * dist, inv);
+                return;
+            }
+
+            std::vector<std::complex<T>> buffer(n);
+
+            for(size_t i = first; i < last; ++ i) {
+                std::complex<T> *signal = data + i * dist;
+                for(size_t j = 0; j < n; ++ j)
+                    buffer[j] = signal[j * stride];
+                transform(buffer.data(), buffer.data(), inv);
+                for(size_t j = 0; j < n; ++ j)
+                    signal[j * stride] = buffer[j];
+            }
+        });
+    }
+
+    /**
+     *  Computes the Fast Fourier Transforms of consecutive signals of length size(), in place.
+     *
+     *  @param P the signals, one after the other. P.size() must be a multiple of size().
+     *  @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+     */
+
+    void execute_many(std::vector<std::complex<T>> &P, int inv = 1) const {
+        assert(P.size() % size() == 0);
+
+        execute_many(P.data(), P.size() / size(), 1, size(), inv);
+    }
+};
+
+/**
+ * A precomputed plan for the Fast Fourier Transform of real-valued data.
+ *
+ * The transform of N real values is Hermitian symmetric, so only its first N / 2 + 1 values are computed and stored.
+ * For even N they are computed with a single complex transform of length N / 2, which is about twice as fast as a complex transform of length N.
+ * Like fft_plan, an rfft_plan is immutable once constructed and may be shared between threads.
+ *
+ * @param T the floating point type of the data.
+ */
+
+template <typename T = long double>
+class rfft_plan {
+
+    private:
+
+    size_t n;
+
+    // For even n, the plan of length n / 2 and the twiddle factors W^k = e^(2 pi i k / n) for k <= n / 4. The rest follow from W^(n / 2 - k) = -conj(W^k). For odd n, a plan of length n.
+
+    fft_plan<T> plan;
+
+    std::vector<std::complex<T>> roots;
+
+    public:
+
+    /**
+     *  Constructs a plan for real transforms of length N.
+     *
+     *  @param N the number of real values transformed.
+     *  @param radix the butterfly used for the stages of a power of two transform.
+     *  @param threads the number of threads a large transform may use, or 0 to use one per hardware thread.
+     */
+
+    explicit rfft_plan(size_t N = 2, fft_radix radix = fft_radix::radix_4, unsigned threads = 1): n(N), plan(N % 2 == 0 ? N / 2 : N, radix, threads) {
+        if(N % 2 == 0) {
+            roots.resize(N / 4 + 1);
+            fft_detail::unit_roots(N).fill(roots.data(), N / 4 + 1);
+        }
+    }
+
+    /**
+     *  Retrieves the number of real values transformed by the plan.
+     *
+     *  @return the length of the transform.
+     */
+
+    inline size_t size() const {
+        return n;
+    }
+
+    /**
+     *  Computes the Fast Fourier Transform of real values in caller-owned memory.
+     *
+     *  @param in the first of the size() real values to transform.
+     *  @param out the first of size() / 2 + 1 values overwritten with the transform. This must not overlap in.
+     */
+
+    void execute(const T *in, std::complex<T> *out) const {
+        if(n % 2 == 1) {
+            std::vector<std::complex<T>> P(in, in + n);
+            plan.execute(P.data(), 1);
+            std::copy(P.begin(), P.begin() + n / 2 + 1, out);
+            return;
+        }
+
+        // Pack the even-indexed values into the real parts and the odd-indexed values into the imaginary parts.
+
+        size_t h = n / 2;
+
+        for(size_t j = 0; j < h; ++ j)
+            out[j] = std::complex<T>(in[2 * j], in[2 * j + 1]);
+
+        plan.execute(out, 1);
+
+        // Unpack with X[k] = E[k] + W^k O[k], where E = (Z[k] + conj(Z[h - k])) / 2 and O = (Z[k] - conj(Z[h - k])) / 2i.
+        // X[k] and X[h - k] depend on the same two values of Z, so they are computed together.
+
+        out[h] = std::complex<T>(out[0].real() - out[0].imag(), 0);
+        out[0] = std::complex<T>(out[0].real() + out[0].imag(), 0);
+
+        for(size_t k = 1; 2 * k <= h; ++ k) {
+            std::complex<T> a = out[k], b = std::conj(out[h - k]);
+            std::complex<T> e = (a + b) * T(0.5), o = (a - b) * std::complex<T>(0, -0.5);
+            out[k] = e + fft_detail::cmul(roots[k], o);
+            // For the mirrored index, E and O are conjugated, and W^(h - k) = -conj(W^k).
+            out[h - k] = std::conj(e) - fft_detail::cmul(std::conj(roots[k]), std::conj(o));
+        }
+    }
+
+    /**
+     *  Computes the Fast Fourier Transform of real values.
+     *
+     *  @param in the size() real values to transform.
+     *  @param out overwritten with the first size() / 2 + 1 values of the transform. The rest are the complex conjugates of these, in reverse order.
+     */
+
+    void execute(const std::vector<T> &in, std::vector<std::complex<T>> &out) const {
+        assert(in.size() == n);
+
+        out.resize(n / 2 + 1);
+
+        execute(in.data(), out.data());
+    }
+
+    /**
+     *  Computes the inverse Fast Fourier Transform of the transform of real values, in caller-owned memory.
+     *
+     *  @param in the first of the size() / 2 + 1 values of a Hermitian symmetric transform.
+     *  @param out the first of size() real values overwritten with the inverse transform. This must not overlap in.
+     */
+
+    void execute(const std::complex<T> *in, T *out) const {
+        if(n % 2 == 1) {
+            std::vector<std::complex<T>> P(n);
+            for(size_t k = 0; k <= n / 2; ++ k) {
+                P[k] = in[k];
+                if(k > 0) P[n - k] = std::conj(in[k]);
+            }
+            plan.execute(P, -1);
+            for(size_t j = 0; j < n; ++ j)
+                out[j] = P[j].real();
+            return;
+        }
+
+        // Invert the unpacking of the forward transform: Z[k] = E[k] + i O[k], with E = (X[k] + conj(X[h - k])) / 2 and O = (X[k] - conj(X[h - k])) W^-k / 2.
+
+        size_t h = n / 2;
+
+        std::vector<std::complex<T>> Z(h);
+
+        for(size_t k = 0; k < h; ++ k) {
+            std::complex<T> a = in[k], b = std::conj(in[h - k]);
+            std::complex<T> w = 2 * k <= h ? std::conj(roots[k]) : -roots[h - k];
+            std::complex<T> e = (a + b) * T(0.5), o = fft_detail::cmul(a - b, w) * T(0.5);
+            Z[k] = e + fft_detail::muli(o);
+        }
+
+        plan.execute(Z, -1);
+
+        for(size_t j = 0; j < h; ++ j) {
+            out[2 * j] = Z[j].real();
+            out[2 * j + 1] = Z[j].imag();
+        }
+    }
+
+    /**
+     *  Computes the inverse Fast Fourier Transform of the transform of real values.
+     *
+     *  @param in the first size() / 2 + 1 values of a Hermitian symmetric transform.
+     *  @param out overwritten with the size() real values.
+     */
+
+    void execute(const std::vector<std::complex<T>> &in, std::vector<T> &out) const {
+        assert(in.size() == n / 2 + 1);
+
+        out.resize(n);
+
+        execute(in.data(), out.data());
+    }
+};
+
+/**
+ * A precomputed plan for the multidimensional Fast Fourier Transform of a contiguous row-major array, such as an image (2D) or a volume (3D).
+ *
+ * The transform is computed one axis at a time, with a one-dimensional plan per axis.
+ * Along the last axis the signals are contiguous. Along the other axes they are strided, so they are gathered a few at a time into contiguous rows, transformed and scattered back.
+ * Each gather reads whole cache lines and acts as a blocked transpose of a thin tile, so the array is never transposed as a whole and no second array is allocated.
+ * Like fft_plan, an fft_nd_plan is immutable once constructed and may be shared between threads.
+ *
+ * @param T the floating point type of the plan.
+ */
+
+template <typename T = long double>
+class fft_nd_plan {
+
+    private:
+
+    std::vector<size_t> shape;
+
+    std::vector<std::shared_ptr<const fft_plan<T>>> plans;
+
+    size_t n;
+
+    unsigned threads;
+
+    /**
+     *  Transforms every signal along one axis.
+     *
+     *  @param P the array.
+     *  @param axis the axis to transform along.
+     *  @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+     */
+
+    void transform_axis(std::complex<T> *P, size_t axis, int inv) const {
+        const fft_plan<T> &plan = *plans[axis];
+
+        size_t L = shape[axis], stride = 1;
+
+        for(size_t a = axis + 1; a < shape.size(); ++ a) stride *= shape[a];
+
+        if(stride == 1) {
+            fft_detail::parallel_for(n / L, threads, [&](size_t first, size_t last) {
+                for(size_t i = first; i < last; ++ i)
+                    plan.execute(P + i * L, inv);
+            });
+            return;
+        }
+
+        // Enough signals to use whole cache lines when gathering them, as in the six-step algorithm.
+        const size_t B = 8;
+
+        size_t blocks = (stride + B - 1) / B;
+
+        fft_detail::parallel_for(n / (L * stride) * blocks, threads, [&](size_t first, size_t last) {
+            std::vector<std::complex<T>> S(B * L);
+
+            for(size_t t = first; t < last; ++ t) {
+                size_t i0 = t % blocks * B, width = std::min(B, stride - i0);
+                std::complex<T> *base = P + t / blocks * L * stride + i0;
+
+                for(size_t j = 0; j < L; ++ j)
+                    for(size_t b = 0; b < width; ++ b)
+                        S[b * L + j] = base[j * stride + b];
+
+                for(size_t b = 0; b < width; ++ b)
+                    plan.execute(S.data() + b * L, inv);
+
+                for(size_t j = 0; j < L; ++ j)
+                    for(size_t b = 0; b < width; ++ b)
+                        base[j * stride + b] = S[b * L + j];
+            }
+        });
+    }
+
+    public:
+
+    /**
+     *  Constructs a plan for arrays of the given shape.
+     *
+     *  @param shape the length of each axis, outermost first. The last axis is contiguous in memory.
+     *  @param threads the number of threads the signals of each axis are spread over. Pass 0 to use every hardware thread.
+     */
+
+    explicit fft_nd_plan(const std::vector<size_t> &shape, unsigned threads = 1): shape(shape), n(1),
+            threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())) {
+        assert(!shape.empty());
+
+        for(size_t a = 0; a < shape.size(); ++ a) {
+            n *= shape[a];
+
+            // Axes of equal length share a plan.
+            size_t b = 0;
+            while(b < a && shape[b] != shape[a]) ++ b;
+            plans.push_back(b < a ? plans[b] : std::make_shared<const fft_plan<T>>(shape[a]));
+        }
+    }
+
+    /**
+     *  Constructs a plan for two-dimensional arrays.
+     *
+     *  @param rows the number of rows.
+     *  @param columns the number of columns, which are contiguous in memory.
+     *  @param threads the number of threads. Pass 0 to use every hardware thread.
+     */
+
+    fft_nd_plan(size_t rows, size_t columns, unsigned threads = 1): fft_nd_plan(std::vector<size_t>{rows, columns}, threads) {}
+
+    /**
+     *  Retrieves the shape of the arrays transformed by the plan.
+     *
+     *  @return the length of each axis, outermost first.
+     */
+
+    inline const std::vector<size_t> &get_shape() const {
+        return shape;
+    }
+
+    /**
+     *  Retrieves the number of values in the arrays transformed by the plan.
+     *
+     *  @return the product of the lengths of the axes.
+     */
+
+    inline size_t size() const {
+        return n;
+    }
+
+    /**
+     *  Computes the multidimensional Fast Fourier Transform of an array in caller-owned memory, in place.
+     *
+     *  @param P the first of the size() contiguous values of the row-major array.
+     *  @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+     */
+
+    void execute(std::complex<T> *P, int inv = 1) const {
+        for(size_t a = shape.size(); a -- > 0;)
+            transform_axis(P, a, inv);
+    }
+
+    /**
+     *  Computes the multidimensional Fast Fourier Transform of an array, in place.
+     *
+     *  @param P the row-major array. P.size() must equal size().
+     *  @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+     */
+
+    void execute(std::vector<std::complex<T>> &P, int inv = 1) const {
+        assert(P.size() == size());
+
+        execute(P.data(), inv);
+    }
+};
+
+/**
+ * Retrieves a plan of length N, constructing it on first use.
+ *
+ * Each thread keeps its own cache of plans, so the returned plan is never shared with, or invalidated by, another thread.
+ *
+ * @param T the floating point type of the plan.
+ * @param N the length of the transform.
+ * @return a plan for transforms of length N.
+ */
+
+template <typename T = long double>
+inline const fft_plan<T> &cached_fft_plan(size_t N) {
+    thread_local std::unordered_map<size_t, fft_plan<T>> plans;
+
+    auto it = plans.find(N);
+    if(it == plans.end()) it = plans.emplace(N, fft_plan<T>(N)).first;
+
+    return it->second;
+}
+
+/**
+ * Retrieves a real plan of length N, constructing it on first use.
+ *
+ * Like cached_fft_plan, each thread keeps its own cache.
+ *
+ * @param T the floating point type of the plan.
+ * @param N the number of real values transformed.
+ * @return a plan for real transforms of length N.
+ */
+
+template <typename T = long double>
+inline const rfft_plan<T> &cached_rfft_plan(size_t N) {
+    thread_local std::unordered_map<size_t, rfft_plan<T>> plans;
+
+    auto it = plans.find(N);
+    if(it == plans.end()) it = plans.emplace(N, rfft_plan<T>(N)).first;
+
+    return it->second;
+}
+
+/**
+ * Retrieves a multidimensional plan of the given shape, constructing it on first use.
+ *
+ * Like cached_fft_plan, each thread keeps its own cache.
+ *
+ * @param T the floating point type of the plan.
+ * @param shape the length of each axis, outermost first.
+ * @return a single-threaded plan for arrays of that shape.
+ */
+
+template <typename T = long double>
+inline const fft_nd_plan<T> &cached_fft_nd_plan(const std::vector<size_t> &shape) {
+    thread_local std::map<std::vector<size_t>, fft_nd_plan<T>> plans;
+
+    auto it = plans.find(shape);
+    if(it == plans.end()) it = plans.emplace(shape, fft_nd_plan<T>(shape)).first;
+
+    return it->second;
+}
+
+/**
+ * An iterative implementation of the Fast Fourier Transform.
+ *
+ * Plans are cached per thread and per length, so repeated transforms (in either direction) do not recompute any twiddle factors, and concurrent calls from different threads do not interfere with each other.
+ * P is padded with zeros up to the next power of two. Use an fft_plan directly for a transform of exactly P.size() points.
+ *
+ * @param T the floating point type of the values: float, double or long double.
+ * @param P an std::vector of std::complex<T> representing the values to compute the FFT of. Note that this vector will be overwritten with the values returned by the FFT.
+ * @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+ */
+
+template <typename T>
+void FFT(std::vector<std::complex<T>> &P, int inv = 1) {
+    size_t length = 1;
+
+    while(length < P.size()) length <<= 1;
+
+    P.resize(length);
+
+    cached_fft_plan<T>(length).execute(P, inv);
+}
+
+/**
+ * Computes the Fast Fourier Transform of values in caller-owned memory, in place.
+ *
+ * Unlike the std::vector overload, the length is not padded: exactly N values are transformed, using this thread's cached plan of length N.
+ *
+ * @param T the floating point type of the values: float, double or long double.
+ * @param P the first of the N contiguous values to compute the FFT of.
+ * @param N the number of values.
+ * @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+ */
+
+template <typename T>
+void FFT(std::complex<T> *P, size_t N, int inv = 1) {
+    cached_fft_plan<T>(N).execute(P, inv);
+}
+
+/**
+ * Computes the two-dimensional Fast Fourier Transform of a row-major array in caller-owned memory, in place.
+ *
+ * Exactly rows x columns values are transformed, using this thread's cached plans, and no padding is added.
+ *
+ * @param T the floating point type of the values: float, double or long double.
+ * @param P the first of the rows x columns contiguous values.
+ * @param rows the number of rows.
+ * @param columns the number of columns, which are contiguous in memory.
+ * @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+ */
+
+template <typename T>
+void FFT2(std::complex<T> *P, size_t rows, size_t columns, int inv = 1) {
+    cached_fft_nd_plan<T>(std::vector<size_t>{rows, columns}).execute(P, inv);
+}
+
+/**
+ * Computes the three-dimensional Fast Fourier Transform of a row-major array in caller-owned memory, in place.
+ *
+ * @param T the floating point type of the values: float, double or long double.
+ * @param P the first of the n0 x n1 x n2 contiguous values.
+ * @param n0 the length of the outermost axis.
+ * @param n1 the length of the middle axis.
+ * @param n2 the length of the innermost axis, which is contiguous in memory.
+ * @param inv pass 1 to compute the Fast Fourier Transform, and -1 to compute the inverse Fast Fourier Transform.
+ */
+
+template <typename T>
+void FFT3(std::complex<T> *P, size_t n0, size_t n1, size_t n2, int inv = 1) {
+    cached_fft_nd_plan<T>(std::vector<size_t>{n0, n1, n2}).execute(P, inv);
 }
 
 #endif
@@ -15,91 +15,1614 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <cstdlib>
 #include <exception>
+#include <initializer_list>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <type_traits>
 #include <vector>
 
+#include "thread_pool.h"
+
+#if !defined(MATRIX_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define MATRIX_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/**
+ * Internal helpers for matrix.h. Nothing in this namespace is part of the interface.
+ */
+
+namespace matrix_detail {
+
+    /**
+     *  The alignment of matrix storage, in bytes: a cache line, which is also the width of an AVX-512 register.
+     */
+
+    const size_t alignment = 64;
+
+    /**
+     *  An allocator returning storage aligned to matrix_detail::alignment bytes, so that rows start on cache line boundaries as often as possible and vector loads never split a line at the start of the buffer.
+     */
+
+    template <typename T>
+    struct aligned_allocator {
+        typedef T value_type;
+
+        aligned_allocator() {}
+
+        template <typename U>
+        aligned_allocator(const aligned_allocator<U> &) {}
+
+        // Portable C++ has no aligned allocation before C++17, so the block is over-allocated with operator new by alignment bytes and the result rounded up.
+        // The address operator new returned is kept in the pointer-sized slot just before the aligned storage, for deallocate.
+
+        T *allocate(size_t n) {
+            if(n > (std::numeric_limits<size_t>::max() - alignment - sizeof(void *)) / sizeof(T)) throw std::bad_alloc();
+
+            char *raw = static_cast<char *>(::operator new(n * sizeof(T) + alignment + sizeof(void *)));
+            uintptr_t start = reinterpret_cast<uintptr_t>(raw + sizeof(void *));
+            char *aligned = raw + sizeof(void *) + (alignment - start % alignment) % alignment;
+
+            reinterpret_cast<void **>(aligned)[-1] = raw;
+            return reinterpret_cast<T *>(aligned);
+        }
+
+        void deallocate(T *p, size_t) {
+            ::operator delete(reinterpret_cast<void **>(p)[-1]);
+        }
+
+        template <typename U>
+        bool operator == (const aligned_allocator<U> &) const {
+            return true;
+        }
+
+        template <typename U>
+        bool operator != (const aligned_allocator<U> &) const {
+            return false;
+        }
+    };
+
+    /**
+     *  Computes C += alpha A B with the straightforward i-k-j loop, for any data type.
+     *
+     *  @param M the number of rows of A and C.
+     *  @param N the number of columns of B and C.
+     *  @param K the number of columns of A and rows of B.
+     *  @param alpha the factor applied to the product.
+     *  @param A the first entry of A, whose rows are lda apart.
+     *  @param B the first entry of B, whose rows are ldb apart.
+     *  @param C the first entry of C, whose rows are ldc apart.
+     */
+
+    template <typename T>
+    void gemm(size_t M, size_t N, size_t K, const T &alpha, const T *A, size_t lda, const T *B, size_t ldb, T *C, size_t ldc) {
+        // The unusual order of loops is an optimization: the innermost loop walks rows of B and C contiguously.
+
+        for(size_t i = 0; i < M; ++ i) {
+            T *c = C + i * ldc;
+            for(size_t k = 0; k < K; ++ k) {
+                const T a = alpha * A[i * lda + k], *b = B + k * ldb;
+                for(size_t j = 0; j < N; ++ j)
+                    c[j] = c[j] + a * b[j];
+            }
+        }
+    }
+
+    /**
+     *  The signature of a GEMM micro-kernel, which computes C += A B for one mr x nr tile of C.
+     *
+     *  @param kc the length of the inner dimension.
+     *  @param a the packed panel of A: mr entries for each k.
+     *  @param b the packed panel of B: nr entries for each k.
+     *  @param c the first entry of the tile.
+     *  @param ldc the distance between rows of the tile.
+     */
+
+    template <typename T>
+    using gemm_kernel = void (*)(size_t kc, const T *a, const T *b, T *c, size_t ldc);
+
+    /**
+     *  A micro-kernel together with its tile size.
+     */
+
+    template <typename T>
+    struct gemm_micro {
+        size_t mr, nr;
+        gemm_kernel<T> run;
+    };
+
+    /**
+     *  Portable micro-kernel, with a 4 x 4 tile of accumulators the compiler can keep in registers.
+     */
+
+    template <typename T>
+    void gemm_kernel_scalar(size_t kc, const T *a, const T *b, T *c, size_t ldc) {
+        T acc[4][4] = {};
+
+        for(size_t k = 0; k < kc; ++ k, a += 4, b += 4)
+            for(size_t i = 0; i < 4; ++ i)
+                for(size_t j = 0; j < 4; ++ j)
+                    acc[i][j] += a[i] * b[j];
+
+        for(size_t i = 0; i < 4; ++ i)
+            for(size_t j = 0; j < 4; ++ j)
+                c[i * ldc + j] += acc[i][j];
+    }
+
+#ifdef MATRIX_X86_SIMD
+
+    // Each vector micro-kernel keeps a tile of 6 rows by 2 registers of accumulators.
+    // Every step loads one row of the B panel into two registers, and multiplies them by 6 broadcast entries of the A panel.
+
+    __attribute__((target("avx2,fma")))
+    inline void gemm_kernel_avx2(size_t kc, const double *a, const double *b, double *c, size_t ldc) {
+        __m256d acc[6][2];
+
+        for(size_t i = 0; i < 6; ++ i)
+            acc[i][0] = acc[i][1] = _mm256_setzero_pd();
+
+        for(size_t k = 0; k < kc; ++ k, a += 6, b += 8) {
+            __m256d b0 = _mm256_loadu_pd(b), b1 = _mm256_loadu_pd(b + 4);
+            for(size_t i = 0; i < 6; ++ i) {
+                __m256d ai = _mm256_broadcast_sd(a + i);
+                acc[i][0] = _mm256_fmadd_pd(ai, b0, acc[i][0]);
+                acc[i][1] = _mm256_fmadd_pd(ai, b1, acc[i][1]);
+            }
+        }
+
+        for(size_t i = 0; i < 6; ++ i) {
+            double *r = c + i * ldc;
+            _mm256_storeu_pd(r, _mm256_add_pd(_mm256_loadu_pd(r), acc[i][0]));
+            _mm256_storeu_pd(r + 4, _mm256_add_pd(_mm256_loadu_pd(r + 4), acc[i][1]));
+        }
+    }
+
+    __attribute__((target("avx2,fma")))
+    inline void gemm_kernel_avx2(size_t kc, const float *a, const float *b, float *c, size_t ldc) {
+        __m256 acc[6][2];
+
+        for(size_t i = 0; i < 6; ++ i)
+            acc[i][0] = acc[i][1] = _mm256_setzero_ps();
+
+        for(size_t k = 0; k < kc; ++ k, a += 6, b += 16) {
+            __m256 b0 = _mm256_loadu_ps(b), b1 = _mm256_loadu_ps(b + 8);
+            for(size_t i = 0; i < 6; ++ i) {
+                __m256 ai = _mm256_broadcast_ss(a + i);
+                acc[i][0] = _mm256_fmadd_ps(ai, b0, acc[i][0]);
+                acc[i][1] = _mm256_fmadd_ps(ai, b1, acc[i][1]);
+            }
+        }
+
+        for(size_t i = 0; i < 6; ++ i) {
+            float *r = c + i * ldc;
+            _mm256_storeu_ps(r, _mm256_add_ps(_mm256_loadu_ps(r), acc[i][0]));
+            _mm256_storeu_ps(r + 8, _mm256_add_ps(_mm256_loadu_ps(r + 8), acc[i][1]));
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    inline void gemm_kernel_avx512(size_t kc, const double *a, const double *b, double *c, size_t ldc) {
+        __m512d acc[6][2];
+
+        for(size_t i = 0; i < 6; ++ i)
+            acc[i][0] = acc[i][1] = _mm512_setzero_pd();
+
+        for(size_t k = 0; k < kc; ++ k, a += 6, b += 16) {
+            __m512d b0 = _mm512_loadu_pd(b), b1 = _mm512_loadu_pd(b + 8);
+            for(size_t i = 0; i < 6; ++ i) {
+                __m512d ai = _mm512_set1_pd(a[i]);
+                acc[i][0] = _mm512_fmadd_pd(ai, b0, acc[i][0]);
+                acc[i][1] = _mm512_fmadd_pd(ai, b1, acc[i][1]);
+            }
+        }
+
+        for(size_t i = 0; i < 6; ++ i) {
+            double *r = c + i * ldc;
+            _mm512_storeu_pd(r, _mm512_add_pd(_mm512_loadu_pd(r), acc[i][0]));
+            _mm512_storeu_pd(r + 8, _mm512_add_pd(_mm512_loadu_pd(r + 8), acc[i][1]));
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    inline void gemm_kernel_avx512(size_t kc, const float *a, const float *b, float *c, size_t ldc) {
+        __m512 acc[6][2];
+
+        for(size_t i = 0; i < 6; ++ i)
+            acc[i][0] = acc[i][1] = _mm512_setzero_ps();
+
+        for(size_t k = 0; k < kc; ++ k, a += 6, b += 32) {
+            __m512 b0 = _mm512_loadu_ps(b), b1 = _mm512_loadu_ps(b + 16);
+            for(size_t i = 0; i < 6; ++ i) {
+                __m512 ai = _mm512_set1_ps(a[i]);
+                acc[i][0] = _mm512_fmadd_ps(ai, b0, acc[i][0]);
+                acc[i][1] = _mm512_fmadd_ps(ai, b1, acc[i][1]);
+            }
+        }
+
+        for(size_t i = 0; i < 6; ++ i) {
+            float *r = c + i * ldc;
+            _mm512_storeu_ps(r, _mm512_add_ps(_mm512_loadu_ps(r), acc[i][0]));
+            _mm512_storeu_ps(r + 16, _mm512_add_ps(_mm512_loadu_ps(r + 16), acc[i][1]));
+        }
+    }
+
+    /**
+     *  Identifies the widest instruction set supported by the running CPU.
+     *
+     *  @return 2 for AVX-512, 1 for AVX2 with FMA, and 0 otherwise.
+     */
+
+    inline int simd_level() {
+        static const int level = []() {
+            __builtin_cpu_init();
+            if(__builtin_cpu_supports("avx512f")) return 2;
+            if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return 1;
+            return 0;
+        }();
+        return level;
+    }
+
+    /**
+     *  Picks the widest micro-kernel supported by the running CPU.
+     *
+     *  @return the selected kernel and its tile size.
+     */
+
+    template <typename T>
+    inline gemm_micro<T> select_gemm_micro() {
+        const size_t lanes = 32 / sizeof(T);
+        switch(simd_level()) {
+            case 2: return gemm_micro<T>{6, 4 * lanes, gemm_kernel_avx512};
+            case 1: return gemm_micro<T>{6, 2 * lanes, gemm_kernel_avx2};
+            default: return gemm_micro<T>{4, 4, gemm_kernel_scalar<T>};
+        }
+    }
+
+#else
+
+    template <typename T>
+    inline gemm_micro<T> select_gemm_micro() {
+        return gemm_micro<T>{4, 4, gemm_kernel_scalar<T>};
+    }
+
+#endif
+
+    /**
+     *  Below this many multiply-adds, packing costs more than it saves, and the straightforward loop is used.
+     */
+
+    const size_t gemm_threshold = 32 * 32 * 32;
+
+    /**
+     *  Computes C += alpha A B for float or double with a packed, cache-blocked algorithm, in the style of GotoBLAS and BLIS.
+     *
+     *  B is split into blocks of kc x nc, packed so that each nr-wide panel is contiguous, and sized for the last level cache.
+     *  A is split into blocks of mc x kc, packed so that each mr-high panel is contiguous, and sized for L2.
+     *  A micro-kernel then multiplies one panel of each, which fits in L1, into an mr x nr tile of C held in registers.
+     *  Panels are padded with zeros, so the kernel always computes a full tile. Partial tiles at the edges of C go through a scratch tile.
+     *  alpha is applied as A is packed, so it costs nothing in the kernel.
+     *
+     *  @param M the number of rows of A and C.
+     *  @param N the number of columns of B and C.
+     *  @param K the number of columns of A and rows of B.
+     *  @param alpha the factor applied to the product.
+     *  @param A the first entry of A, whose rows are lda apart.
+     *  @param B the first entry of B, whose rows are ldb apart.
+     *  @param C the first entry of C, whose rows are ldc apart.
+     */
+
+    template <typename T>
+    void gemm_blocked(size_t M, size_t N, size_t K, T alpha, const T *A, size_t lda, const T *B, size_t ldb, T *C, size_t ldc) {
+        static const gemm_micro<T> micro = select_gemm_micro<T>();
+
+        const size_t mr = micro.mr, nr = micro.nr;
+        const size_t kc_max = 256, mc_max = 20 * mr, nc_max = 64 * nr;
+
+        // The buffers hold one block each, but no more than the whole rounded-up operand when it is smaller than a block.
+        const size_t kc_size = std::min(kc_max, K);
+        const size_t mc_size = std::min(mc_max, (M + mr - 1) / mr * mr), nc_size = std::min(nc_max, (N + nr - 1) / nr * nr);
+
+        std::vector<T, aligned_allocator<T>> Ap(mc_size * kc_size), Bp(nc_size * kc_size), tile(mr * nr);
+
+        for(size_t jc = 0; jc < N; jc += nc_max) {
+            size_t nc = std::min(nc_max, N - jc);
+
+            for(size_t pc = 0; pc < K; pc += kc_max) {
+                size_t kc = std::min(kc_max, K - pc);
+
+                for(size_t jr = 0; jr < nc; jr += nr) {
+                    T *p = Bp.data() + jr * kc;
+                    size_t w = std::min(nr, nc - jr);
+                    for(size_t k = 0; k < kc; ++ k, p += nr) {
+                        const T *b = B + (pc + k) * ldb + jc + jr;
+                        for(size_t j = 0; j < w; ++ j) p[j] = b[j];
+                        for(size_t j = w; j < nr; ++ j) p[j] = T(0);
+                    }
+                }
+
+                for(size_t ic = 0; ic < M; ic += mc_max) {
+                    size_t mc = std::min(mc_max, M - ic);
+
+                    for(size_t ir = 0; ir < mc; ir += mr) {
+                        T *p = Ap.data() + ir * kc;
+                        size_t h = std::min(mr, mc - ir);
+                        for(size_t k = 0; k < kc; ++ k, p += mr) {
+                            const T *a = A + (ic + ir) * lda + pc + k;
+                            for(size_t i = 0; i < h; ++ i) p[i] = alpha * a[i * lda];
+                            for(size_t i = h; i < mr; ++ i) p[i] = T(0);
+                        }
+                    }
+
+                    for(size_t jr = 0; jr < nc; jr += nr) {
+                        for(size_t ir = 0; ir < mc; ir += mr) {
+                            const T *a = Ap.data() + ir * kc, *b = Bp.data() + jr * kc;
+                            T *c = C + (ic + ir) * ldc + jc + jr;
+                            size_t h = std::min(mr, mc - ir), w = std::min(nr, nc - jr);
+
+                            if(h == mr && w == nr) {
+                                micro.run(kc, a, b, c, ldc);
+                                continue;
+                            }
+
+                            std::fill(tile.begin(), tile.end(), T(0));
+                            micro.run(kc, a, b, tile.data(), nr);
+                            for(size_t i = 0; i < h; ++ i)
+                                for(size_t j = 0; j < w; ++ j)
+                                    c[i * ldc + j] += tile[i * nr + j];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     *  Below this many multiply-adds, waking the pool costs more than it saves, and the product runs on the calling thread.
+     */
+
+    const size_t gemm_parallel_threshold = 128 * 128 * 128;
+
+    /**
+     *  Computes C += alpha A B for float or double, with tiles of C spread over a thread pool.
+     *
+     *  Each tile is a separate blocked product with its own packed buffers, so tiles share nothing but the read-only A and B.
+     *  Tiles are one block of A high, and as wide as a block of B, narrowed until there are several tiles for each thread to balance the load.
+     *
+     *  @param pool the pool to run on. If it is busy, the product runs on the calling thread.
+     *  @param M the number of rows of A and C.
+     *  @param N the number of columns of B and C.
+     *  @param K the number of columns of A and rows of B.
+     *  @param alpha the factor applied to the product.
+     *  @param A the first entry of A, whose rows are lda apart.
+     *  @param B the first entry of B, whose rows are ldb apart.
+     *  @param C the first entry of C, whose rows are ldc apart.
+     */
+
+    template <typename T>
+    void gemm_parallel(thread_pool &pool, size_t M, size_t N, size_t K, T alpha, const T *A, size_t lda, const T *B, size_t ldb, T *C, size_t ldc) {
+        const gemm_micro<T> micro = select_gemm_micro<T>();
+
+        size_t tm = 20 * micro.mr, tn = 64 * micro.nr;
+
+        while(tn > 4 * micro.nr && ((M + tm - 1) / tm) * ((N + tn - 1) / tn) < 4 * pool.size())
+            tn /= 2;
+
+        size_t rows = (M + tm - 1) / tm, columns = (N + tn - 1) / tn;
+
+        auto tile = [&](size_t t) {
+            size_t i = t / columns * tm, j = t % columns * tn;
+            gemm_blocked(std::min(tm, M - i), std::min(tn, N - j), K, alpha, A + i * lda, lda, B + j, ldb, C + i * ldc + j, ldc);
+        };
+
+        if(!pool.run(rows * columns, tile))
+            gemm_blocked(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    }
+
+    /**
+     *  Computes C += alpha A B for float or double, picking the straightforward loop, the blocked product or the parallel product by size.
+     */
+
+    template <typename T>
+    void gemm_dispatch(size_t M, size_t N, size_t K, T alpha, const T *A, size_t lda, const T *B, size_t ldb, T *C, size_t ldc) {
+        size_t work = M * N * K;
+
+        if(work < gemm_threshold) gemm<T>(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+        else if(work < gemm_parallel_threshold || thread_pool::shared().size() == 1) gemm_blocked(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+        else gemm_parallel(thread_pool::shared(), M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    }
+
+    inline void gemm(size_t M, size_t N, size_t K, const double &alpha, const double *A, size_t lda, const double *B, size_t ldb, double *C, size_t ldc) {
+        gemm_dispatch(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    }
+
+    inline void gemm(size_t M, size_t N, size_t K, const float &alpha, const float *A, size_t lda, const float *B, size_t ldb, float *C, size_t ldc) {
+        gemm_dispatch(M, N, K, alpha, A, lda, B, ldb, C, ldc);
+    }
+}
+
 /**
  *  degenerate_matrix_error class, thrown whenever one tries to invert a degenerate matrix
  */
 
-class degenerate_matrix_error : public std::exception {
+class degenerate_matrix_error : public std::exception {
+
+    public:
+
+    virtual const char* what() const throw() {
+      return "Attempted to take the inverse of degenerate matrix!";
+    }
+};
+
+/**
+ *  A matrix of T. matrix<T> has its dimensions chosen at run time, and matrix<T, R, C> has R rows and C columns fixed at compile time.
+ */
+
+template <typename T = int, size_t R = 0, size_t C = 0>
+class matrix;
+
+/**
+ *  Expression templates for matrix arithmetic. Nothing in this namespace is part of the interface either.
+ *
+ *  Arithmetic on matrices builds a lightweight node describing the result instead of computing it. The work is done when the node is assigned to a matrix:
+ *  element-wise sums, differences, negations and scalings are computed together in a single loop, straight into the destination, and a product added to anything becomes one GEMM that accumulates into it.
+ *  Nodes refer to the matrices they were built from, so they must be assigned before the full expression ends.
+ */
+
+namespace matrix_detail {
+
+    /**
+     *  An element-wise node reading a matrix.
+     */
+
+    template <typename T>
+    struct leaf {
+        typedef T value_type;
+
+        const T *p;
+        size_t n_rows, n_columns;
+
+        inline size_t rows() const { return n_rows; }
+        inline size_t columns() const { return n_columns; }
+        inline T operator [] (size_t i) const { return p[i]; }
+    };
+
+    /**
+     *  An element-wise node reading a product that had to be computed first, because it appears somewhere it cannot be fused.
+     */
+
+    template <typename T>
+    struct owned {
+        typedef T value_type;
+
+        std::shared_ptr<const matrix<T>> m;
+
+        inline size_t rows() const { return m->rows(); }
+        inline size_t columns() const { return m->columns(); }
+        inline T operator [] (size_t i) const { return m->data()[i]; }
+    };
+
+    struct add_op {
+        template <typename T>
+        static inline T apply(const T &a, const T &b) { return a + b; }
+    };
+
+    struct subtract_op {
+        template <typename T>
+        static inline T apply(const T &a, const T &b) { return a - b; }
+    };
+
+    /**
+     *  The element-wise sum or difference of two nodes of the same shape.
+     */
+
+    template <typename Op, typename L, typename R>
+    struct binary {
+        typedef typename L::value_type value_type;
+
+        L l;
+        R r;
+
+        inline size_t rows() const { return l.rows(); }
+        inline size_t columns() const { return l.columns(); }
+        inline value_type operator [] (size_t i) const { return Op::apply(l[i], r[i]); }
+    };
+
+    template <typename E>
+    struct negation {
+        typedef typename E::value_type value_type;
+
+        E e;
+
+        inline size_t rows() const { return e.rows(); }
+        inline size_t columns() const { return e.columns(); }
+        inline value_type operator [] (size_t i) const { return -e[i]; }
+    };
+
+    template <typename E>
+    struct scaled {
+        typedef typename E::value_type value_type;
+
+        E e;
+        value_type t;
+
+        inline size_t rows() const { return e.rows(); }
+        inline size_t columns() const { return e.columns(); }
+        inline value_type operator [] (size_t i) const { return e[i] * t; }
+    };
+
+    /**
+     *  The product alpha A B. It has no element-wise form: it is either computed by gemm on its own, or accumulated into the result of a sum.
+     *  Operands that are themselves expressions are computed first, and kept alive by hold_a and hold_b.
+     */
+
+    template <typename T>
+    struct product {
+        typedef T value_type;
+
+        std::shared_ptr<const matrix<T>> hold_a, hold_b;
+        leaf<T> a, b;
+        T alpha;
+
+        inline size_t rows() const { return a.rows(); }
+        inline size_t columns() const { return b.columns(); }
+
+        /**
+         *  Adds the product to a matrix of its shape.
+         *
+         *  @param C the first entry of the matrix, with rows columns() apart.
+         */
+
+        inline void accumulate(T *C) const {
+            gemm(a.rows(), b.columns(), a.columns(), alpha, a.p, a.columns(), b.p, b.columns(), C, b.columns());
+        }
+
+        /**
+         *  Checks whether the product reads a matrix, in which case it cannot be computed into that matrix.
+         */
+
+        inline bool reads(const T *q) const {
+            return a.p == q || b.p == q;
+        }
+    };
+
+    /**
+     *  The product p plus the element-wise node e, computed as e followed by a GEMM accumulating p into it.
+     */
+
+    template <typename E>
+    struct product_sum {
+        typedef typename E::value_type value_type;
+
+        product<value_type> p;
+        E e;
+
+        inline size_t rows() const { return e.rows(); }
+        inline size_t columns() const { return e.columns(); }
+    };
+
+    /**
+     *  Classifies the operands of matrix arithmetic: 0 for matrices and element-wise nodes, 1 for products, 2 for product sums, and -1 for anything else.
+     */
+
+    template <typename X>
+    struct kind : std::integral_constant<int, -1> {};
+
+    template <typename T>
+    struct kind<matrix<T>> : std::integral_constant<int, 0> {};
+
+    template <typename T>
+    struct kind<leaf<T>> : std::integral_constant<int, 0> {};
+
+    template <typename T>
+    struct kind<owned<T>> : std::integral_constant<int, 0> {};
+
+    template <typename Op, typename L, typename R>
+    struct kind<binary<Op, L, R>> : std::integral_constant<int, 0> {};
+
+    template <typename E>
+    struct kind<negation<E>> : std::integral_constant<int, 0> {};
+
+    template <typename E>
+    struct kind<scaled<E>> : std::integral_constant<int, 0> {};
+
+    template <typename T>
+    struct kind<product<T>> : std::integral_constant<int, 1> {};
+
+    template <typename E>
+    struct kind<product_sum<E>> : std::integral_constant<int, 2> {};
+
+    /**
+     *  Whether X is an expression node, as opposed to a matrix or anything else.
+     */
+
+    template <typename X>
+    struct is_expression : std::integral_constant<bool, kind<X>::value >= 0> {};
+
+    template <typename T>
+    struct is_expression<matrix<T>> : std::false_type {};
+
+    /**
+     *  Converts an operand to an element-wise node: a matrix to a leaf, and a product or product sum to the matrix it computes.
+     */
+
+    template <typename X, int K = kind<X>::value>
+    struct operand {
+        typedef X type;
+        static inline const X &get(const X &x) { return x; }
+    };
+
+    template <typename T>
+    struct operand<matrix<T>, 0> {
+        typedef leaf<T> type;
+        static inline type get(const matrix<T> &m) { return type{m.data(), m.rows(), m.columns()}; }
+    };
+
+    template <typename X>
+    struct operand<X, 1> {
+        typedef owned<typename X::value_type> type;
+        static inline type get(const X &x) { return type{std::make_shared<const matrix<typename X::value_type>>(x)}; }
+    };
+
+    template <typename X>
+    struct operand<X, 2> : operand<X, 1> {};
+
+    /**
+     *  Converts an operand of a product to a leaf, computing it first unless it is a matrix.
+     */
+
+    template <typename T>
+    inline leaf<T> factor(const matrix<T> &m, std::shared_ptr<const matrix<T>> &) {
+        return leaf<T>{m.data(), m.rows(), m.columns()};
+    }
+
+    template <typename X>
+    inline leaf<typename X::value_type> factor(const X &x, std::shared_ptr<const matrix<typename X::value_type>> &hold) {
+        hold = std::make_shared<const matrix<typename X::value_type>>(x);
+        return factor(*hold, hold);
+    }
+
+    /**
+     *  Builds the node for L + R. A product on either side, alone or already in a product sum, absorbs the other side into a product sum.
+     */
+
+    template <typename L, typename R, int KL = kind<L>::value, int KR = kind<R>::value>
+    struct add_rule {};
+
+    template <typename L, typename R>
+    struct add_rule<L, R, 0, 0> {
+        typedef binary<add_op, typename operand<L>::type, typename operand<R>::type> type;
+        static inline type apply(const L &l, const R &r) { return type{operand<L>::get(l), operand<R>::get(r)}; }
+    };
+
+    template <typename L, typename R, int KR>
+    struct add_rule<L, R, 1, KR> {
+        typedef product_sum<typename operand<R>::type> type;
+        static inline type apply(const L &l, const R &r) { return type{l, operand<R>::get(r)}; }
+    };
+
+    template <typename L, typename R>
+    struct add_rule<L, R, 0, 1> {
+        typedef product_sum<typename operand<L>::type> type;
+        static inline type apply(const L &l, const R &r) { return type{r, operand<L>::get(l)}; }
+    };
+
+    template <typename L, typename R, int KR>
+    struct add_rule<L, R, 2, KR> {
+        typedef product_sum<binary<add_op, decltype(L::e), typename operand<R>::type>> type;
+        static inline type apply(const L &l, const R &r) { return type{l.p, {l.e, operand<R>::get(r)}}; }
+    };
+
+    template <typename L, typename R>
+    struct add_rule<L, R, 0, 2> {
+        typedef product_sum<binary<add_op, typename operand<L>::type, decltype(R::e)>> type;
+        static inline type apply(const L &l, const R &r) { return type{r.p, {operand<L>::get(l), r.e}}; }
+    };
+
+    /**
+     *  Negates a product by negating its factor alpha.
+     */
+
+    template <typename T>
+    inline product<T> negate(product<T> p) {
+        p.alpha = -p.alpha;
+        return p;
+    }
+
+    /**
+     *  Builds the node for L - R, in the same way as add_rule. A product subtracted from something is fused with its factor negated.
+     */
+
+    template <typename L, typename R, int KL = kind<L>::value, int KR = kind<R>::value>
+    struct subtract_rule {};
+
+    template <typename L, typename R>
+    struct subtract_rule<L, R, 0, 0> {
+        typedef binary<subtract_op, typename operand<L>::type, typename operand<R>::type> type;
+        static inline type apply(const L &l, const R &r) { return type{operand<L>::get(l), operand<R>::get(r)}; }
+    };
+
+    template <typename L, typename R, int KR>
+    struct subtract_rule<L, R, 1, KR> {
+        typedef product_sum<negation<typename operand<R>::type>> type;
+        static inline type apply(const L &l, const R &r) { return type{l, {operand<R>::get(r)}}; }
+    };
+
+    template <typename L, typename R>
+    struct subtract_rule<L, R, 0, 1> {
+        typedef product_sum<typename operand<L>::type> type;
+        static inline type apply(const L &l, const R &r) { return type{negate(r), operand<L>::get(l)}; }
+    };
+
+    template <typename L, typename R, int KR>
+    struct subtract_rule<L, R, 2, KR> {
+        typedef product_sum<binary<subtract_op, decltype(L::e), typename operand<R>::type>> type;
+        static inline type apply(const L &l, const R &r) { return type{l.p, {l.e, operand<R>::get(r)}}; }
+    };
+
+    template <typename L, typename R>
+    struct subtract_rule<L, R, 0, 2> {
+        typedef product_sum<binary<subtract_op, typename operand<L>::type, decltype(R::e)>> type;
+        static inline type apply(const L &l, const R &r) { return type{negate(r.p), {operand<L>::get(l), r.e}}; }
+    };
+
+    /**
+     *  Builds the node for -X.
+     */
+
+    template <typename X, int K = kind<X>::value>
+    struct negate_rule {};
+
+    template <typename X>
+    struct negate_rule<X, 0> {
+        typedef negation<typename operand<X>::type> type;
+        static inline type apply(const X &x) { return type{operand<X>::get(x)}; }
+    };
+
+    template <typename X>
+    struct negate_rule<X, 1> {
+        typedef X type;
+        static inline type apply(const X &x) { return negate(x); }
+    };
+
+    template <typename X>
+    struct negate_rule<X, 2> {
+        typedef product_sum<negation<decltype(X::e)>> type;
+        static inline type apply(const X &x) { return type{negate(x.p), {x.e}}; }
+    };
+
+    /**
+     *  Builds the node for X * t.
+     */
+
+    template <typename X, int K = kind<X>::value>
+    struct scale_rule {};
+
+    template <typename X>
+    struct scale_rule<X, 0> {
+        typedef typename operand<X>::type::value_type value_type;
+        typedef scaled<typename operand<X>::type> type;
+        static inline type apply(const X &x, const value_type &t) { return type{operand<X>::get(x), t}; }
+    };
+
+    template <typename X>
+    struct scale_rule<X, 1> {
+        typedef typename X::value_type value_type;
+        typedef X type;
+        static inline type apply(X x, const value_type &t) {
+            x.alpha = x.alpha * t;
+            return x;
+        }
+    };
+
+    template <typename X>
+    struct scale_rule<X, 2> {
+        typedef typename X::value_type value_type;
+        typedef product_sum<scaled<decltype(X::e)>> type;
+        static inline type apply(const X &x, const value_type &t) { return type{scale_rule<decltype(X::p)>::apply(x.p, t), {x.e, t}}; }
+    };
+
+    /**
+     *  Builds the node for L * R, whose operands must hold the same data type.
+     */
+
+    template <typename L, typename R, bool = (kind<L>::value >= 0 && kind<R>::value >= 0)>
+    struct multiply_rule {};
+
+    template <typename L, typename R>
+    struct multiply_rule<L, R, true> {
+        typedef typename operand<L>::type::value_type value_type;
+        typedef product<value_type> type;
+
+        static_assert(std::is_same<value_type, typename operand<R>::type::value_type>::value, "matrix operands must hold the same data type");
+
+        static inline type apply(const L &l, const R &r) {
+            type ret;
+            ret.a = factor(l, ret.hold_a);
+            ret.b = factor(r, ret.hold_b);
+            ret.alpha = value_type(1);
+            assert(ret.a.columns() == ret.b.rows());
+            return ret;
+        }
+    };
+
+    /**
+     *  Computes a node into a matrix of its shape.
+     *
+     *  @param out the first entry of the matrix.
+     *  @param e the node.
+     */
+
+    template <typename E>
+    inline void assign(typename E::value_type *out, const E &e) {
+        size_t n = e.rows() * e.columns();
+        for(size_t i = 0; i < n; ++ i)
+            out[i] = e[i];
+    }
+
+    template <typename T>
+    inline void assign(T *out, const product<T> &p) {
+        std::fill(out, out + p.rows() * p.columns(), T(0));
+        p.accumulate(out);
+    }
+
+    template <typename E>
+    inline void assign(typename E::value_type *out, const product_sum<E> &s) {
+        assign(out, s.e);
+        s.p.accumulate(out);
+    }
+
+    /**
+     *  Checks whether computing a node into a matrix would overwrite something it still has to read.
+     *  Element-wise nodes read each entry before writing the same entry, so only products are at risk.
+     */
+
+    template <typename E>
+    inline bool aliases(const E &, const typename E::value_type *) {
+        return false;
+    }
+
+    template <typename T>
+    inline bool aliases(const product<T> &p, const T *q) {
+        return p.reads(q);
+    }
+
+    template <typename E>
+    inline bool aliases(const product_sum<E> &s, const typename E::value_type *q) {
+        return s.p.reads(q);
+    }
+}
+
+/**
+ *  matrix class, for representation and manipulation of matrices
+ *
+ *  @param T the data type being stored in the matrix.
+ */
+
+template <typename T>
+class matrix<T, 0, 0> {
+
+    private:
+
+    // The entries, in a single row-major buffer. Entry (i, j) is at i * n_columns + j.
+
+    std::vector<T, matrix_detail::aligned_allocator<T>> entries;
+
+    size_t n_rows, n_columns;
+
+    public:
+
+    /**
+     *  Constructs an empty, 0 x 0 matrix.
+     */
+
+    inline matrix (): n_rows(0), n_columns(0) {}
+
+    /**
+     *  Default matrix constructor. All entries are set to their default.
+     *
+     *  @param Rows the number of rows in the matrix.
+     *  @param Columns the number of columns in the matrix.
+     */
+
+    inline matrix (size_t Rows, size_t Columns): entries(Rows * Columns, T()), n_rows(Rows), n_columns(Columns) {}
+
+    /**
+     *  Alternate matrix constructor. All entries are set to t.
+     *
+     *  @param Rows the number of rows in the matrix.
+     *  @param Columns the number of columns in the matrix.
+     *  @param t the value to set all entries equal to.
+     */
+
+    inline matrix (size_t Rows, size_t Columns, T t): entries(Rows * Columns, t), n_rows(Rows), n_columns(Columns) {}
+
+    /**
+     *  Converting constructor, from a matrix of another data type, or from a fixed-size matrix.
+     *
+     *  @param m the matrix to convert.
+     */
+
+    template <typename U, size_t R, size_t C>
+    explicit matrix (const matrix<U, R, C> &m): entries(m.data(), m.data() + m.rows() * m.columns()), n_rows(m.rows()), n_columns(m.columns()) {}
+
+    /**
+     *  Implicit conversion from a fixed-size matrix of the same data type, so that one can be stored in or passed as a matrix<T>.
+     *
+     *  @param m the matrix to convert.
+     */
+
+    template <size_t R, size_t C>
+    matrix (const matrix<T, R, C> &m): entries(m.data(), m.data() + R * C), n_rows(R), n_columns(C) {}
+
+    /**
+     *  Computes the result of matrix arithmetic, in a single pass over one new allocation.
+     *
+     *  @param e the expression, such as A + B * 2 or A * B - C.
+     */
+
+    template <typename E, typename = typename std::enable_if<matrix_detail::is_expression<E>::value>::type>
+    matrix (const E &e): entries(e.rows() * e.columns()), n_rows(e.rows()), n_columns(e.columns()) {
+        matrix_detail::assign(data(), e);
+    }
+
+    /**
+     *  Computes the result of matrix arithmetic into this matrix.
+     *
+     *  When the shapes match, the result is written in place with no allocation, unless a product would overwrite one of its own factors.
+     *
+     *  @param e the expression, which may refer to this matrix.
+     *  @return this matrix.
+     */
+
+    template <typename E>
+    typename std::enable_if<matrix_detail::is_expression<E>::value, matrix &>::type operator = (const E &e) {
+        if(rows() != e.rows() || columns() != e.columns() || matrix_detail::aliases(e, data())) {
+            matrix<T> tmp(e);
+            std::swap(entries, tmp.entries);
+            n_rows = tmp.n_rows;
+            n_columns = tmp.n_columns;
+        } else {
+            matrix_detail::assign(data(), e);
+        }
+
+        return *this;
+    }
+
+    /**
+     *  Returns the identity matrix of size N x N.
+     *
+     *  @return a N x N identity matrix, if such a matrix is valid.
+     */
+
+    static inline matrix<T> identity(size_t N) {
+        matrix<T>ret = matrix(N, N, T(0));
+
+        for(size_t i = 0; i < N; ++ i)
+            ret(i,i) = 1;
+
+        return ret;
+    }
+
+    /**
+     *  Retrieves the number of rows in the matrix.
+     *
+     *  @return the number of rows in the matrix.
+     */
+
+    inline size_t rows() const {
+        return n_rows;
+    }
+
+
+    /**
+     *  Retrieves the number of columns in the matrix.
+     *
+     *  @return the number of columns in the matrix.
+     */
+
+    inline size_t columns() const {
+        return n_columns;
+    }
+
+    /**
+     *  Retrieves the distance between the starts of consecutive rows in data().
+     *
+     *  @return the row stride, in entries. The column stride is 1.
+     */
+
+    inline size_t stride() const {
+        return n_columns;
+    }
+
+    /**
+     *  Allows direct access to the storage, for kernels that walk it with pointers.
+     *
+     *  @return a pointer to entry (0, 0). Entry (i, j) is at data()[i * stride() + j].
+     */
+
+    inline T *data() {
+        return entries.data();
+    }
+
+    /**
+     *  Allows direct access to the storage, for kernels that walk it with pointers.
+     *
+     *  @return a const pointer to entry (0, 0). Entry (i, j) is at data()[i * stride() + j].
+     */
+
+    inline const T *data() const {
+        return entries.data();
+    }
+
+
+    /**
+     *  Adds a matrix, or the result of matrix arithmetic, to this matrix in place. C += A * B accumulates the product straight into C.
+     *
+     *  @param x the matrix or expression to add.
+     *  @return this matrix.
+     */
+
+    template <typename X>
+    typename std::enable_if<(matrix_detail::kind<X>::value >= 0), matrix &>::type operator += (const X &x) {
+        return *this = *this + x;
+    }
+
+    /**
+     *  Subtracts a matrix, or the result of matrix arithmetic, from this matrix in place.
+     *
+     *  @param x the matrix or expression to subtract.
+     *  @return this matrix.
+     */
+
+    template <typename X>
+    typename std::enable_if<(matrix_detail::kind<X>::value >= 0), matrix &>::type operator -= (const X &x) {
+        return *this = *this - x;
+    }
+
+    /**
+     *  Scales this matrix by a constant factor in place.
+     *
+     *  @param t the constant to scale the matrix by.
+     *  @return this matrix.
+     */
+
+    inline matrix &operator *= (const T t) {
+        for(size_t i = 0; i < entries.size(); ++ i)
+            entries[i] = entries[i] * t;
+
+        return *this;
+    }
+
+    /**
+     *  Computes the inverse of the matrix.
+     *
+     *  @param T1 the data type of the inverted matrix.
+     *  @return the inverse matrix.
+     *  @throws degenernate_matrix_error if the matrix is degenerate
+     */
+
+    template<typename T1 = long double>
+    inline matrix<T1> inverse() const {
+        assert(rows() == columns());
+
+        matrix<T1> tmp(*this);
+        matrix<T1> ret = matrix<T1>::identity(rows());
+
+        // This is where the fun starts...
+
+        for(size_t i = 0, j; i < rows(); ++ i) {
+            for(j = i; j < rows() && tmp(j,i) == T1(0); ++ j);
+            if(j == rows()) {
+                throw degenerate_matrix_error();
+            }
+            if(i != j) {
+                for(size_t k = i; k < columns(); ++ k) {
+                    std::swap(tmp(i,k), tmp(j,k));
+                    std::swap(ret(i,k), ret(j,k));
+                }
+            }
+            for(size_t j = 0; j < columns(); ++ j) {
+                if(j == i) continue;
+                tmp(i,j) = tmp(i,j) / tmp(i,i);
+                ret(i,j) = ret(i,j) / tmp(i,i);
+            }
+            ret(i,i) = ret(i,i) / tmp(i,i);
+            tmp(i,i) = 1.0;
+            for(j = 0; j < rows(); ++ j) {
+                if(j == i) continue;
+                T1 entry = tmp(j,i);
+                for(size_t k = 0; k < columns(); ++k) {
+                    tmp(j,k) = tmp(j,k) - (tmp(i,k) / tmp(i,i)) * entry;
+                    ret(j,k) = ret(j,k) - (ret(i,k) / tmp(i,i)) * entry;
+                }
+            }
+        }
+
+        return ret;
+    }
+
+    /**
+     *  Computes the matrix determinant.
+     *
+     *  @param T1 the data type of the determinant.
+     *  @return the determinant.
+     */
+
+    template<typename T1 = long double>
+    inline T1 determinant() const {
+        assert(rows() == columns());
+
+        matrix<T1> tmp(*this);
+
+        T1 res = T1(1);
+
+        bool b = 0;
+
+        for(size_t i = 0, j; i < rows() - 1; ++ i) {
+            for(j = i; j < rows() && tmp(j,i) == T1(0); ++ j);
+            if(j == rows()) {
+                return T1(0);
+            }
+            if(i != j) {
+                for(size_t k = i; k < columns(); ++ k) {
+                    std::swap(tmp(i,k), tmp(j,k));
+                }
+                b ^= 1;
+            }
+            for(j = i + 1; j < rows(); ++ j) {
+                T1 entry = tmp(j,i);
+                for(size_t k = i; k < columns(); ++ k) {
+                    tmp(j,k) = tmp(j,k) - (tmp(i,k) / tmp(i,i)) * entry;
+                }
+            }
+        }
+
+        for(size_t i = 0; i < rows(); ++ i)
+            res = res * tmp(i,i);
+
+        return b ? -res : res;
+    }
+
+    /**
+     *  Allows access to the matrix entries.
+     *
+     *  @param row the row the entry is in.
+     *  @param column the column the entry is in.
+     *  @return a reference corresponding the the [row][column]-th element of the matrix.
+     */
+
+    inline T &operator () (size_t row, size_t column) {
+        return entries[row * n_columns + column];
+    }
+
+    /**
+     *  Allows access to the matrix entries.
+     *  
+     *  @param row the row the entry is in.
+     *  @param column the column the entry is in.
+     *  @return a const_reference corresponding to the [row][column]-th element of the matrix.
+     */
+
+    inline const T &operator () (size_t row, size_t column) const {
+        return entries[row * n_columns + column];
+    }
+
+    /**
+     *  Checks if two matrices are not equal to each other.
+     *
+     *  @param a the first matrix.
+     *  @param b the matrix to compare to.
+     *  @return true if the two are not equal, and false otherwise.
+     */
+
+    friend inline bool operator != (const matrix<T> &a, const matrix<T> &b) {
+        if(a.rows() != b.rows() || a.columns() != b.columns()) return true;
+        for(size_t i = 0; i < a.entries.size(); ++ i)
+            if(a.entries[i] != b.entries[i])
+                return true;
+        return false;
+    }
+
+    /**
+     *  Checks if two matrices are equal to each other.
+     *
+     *  @param a the first matrix.
+     *  @param b the matrix to compare to.
+     *  @return true if the two are equal, and false otherwise.
+    */
+
+    friend inline bool operator == (const matrix<T> &a, const matrix<T> &b) {
+        return !(a != b);
+    }
+
+    /**
+     *  Computes the transpose of the matrix.
+     *
+     *  @return the transposed matrix.
+     */
+
+    inline matrix transpose() const {
+        matrix ret = matrix(columns(), rows());
+
+        for(size_t i = 0; i < rows(); ++ i)
+            for(size_t j = 0; j < columns(); ++ j)
+                ret(j,i) = entries[i * n_columns + j];
+
+        return ret;
+    }
+};
+
+// Matrix arithmetic builds expression nodes, which are computed when assigned to a matrix.
+
+/**
+ *  Adds two matrices, or results of matrix arithmetic.
+ *
+ *  @param l the left operand.
+ *  @param r the right operand, of the same shape.
+ *  @return a node for the sum.
+ */
+
+template <typename L, typename R>
+inline typename matrix_detail::add_rule<L, R>::type operator + (const L &l, const R &r) {
+    assert(l.rows() == r.rows() && l.columns() == r.columns());
+    return matrix_detail::add_rule<L, R>::apply(l, r);
+}
+
+/**
+ *  Subtracts two matrices, or results of matrix arithmetic.
+ *
+ *  @param l the left operand.
+ *  @param r the right operand, of the same shape.
+ *  @return a node for the difference.
+ */
+
+template <typename L, typename R>
+inline typename matrix_detail::subtract_rule<L, R>::type operator - (const L &l, const R &r) {
+    assert(l.rows() == r.rows() && l.columns() == r.columns());
+    return matrix_detail::subtract_rule<L, R>::apply(l, r);
+}
+
+/**
+ *  Negates all entries of a matrix, or of a result of matrix arithmetic.
+ *
+ *  @param x the operand.
+ *  @return a node for the operand scaled by -1.
+ */
+
+template <typename X>
+inline typename matrix_detail::negate_rule<X>::type operator - (const X &x) {
+    return matrix_detail::negate_rule<X>::apply(x);
+}
+
+/**
+ *  Scales a matrix, or a result of matrix arithmetic, by a constant factor.
+ *
+ *  @param x the operand.
+ *  @param t the constant to scale by.
+ *  @return a node for the operand scaled by t.
+ */
+
+template <typename X>
+inline typename matrix_detail::scale_rule<X>::type operator * (const X &x, const typename matrix_detail::scale_rule<X>::value_type &t) {
+    return matrix_detail::scale_rule<X>::apply(x, t);
+}
+
+/**
+ *  Multiplies two matrices, or results of matrix arithmetic. float and double go through the blocked GEMM, and every other type through the straightforward loop.
+ *
+ *  @param l the left operand.
+ *  @param r the right operand, with as many rows as l has columns.
+ *  @return a node for the product.
+ */
+
+template <typename L, typename R>
+inline typename matrix_detail::multiply_rule<L, R>::type operator * (const L &l, const R &r) {
+    return matrix_detail::multiply_rule<L, R>::apply(l, r);
+}
+
+/**
+ *  Closed forms of the determinant and inverse of small fixed-size matrices, also internal.
+ */
+
+namespace matrix_detail {
+
+    /**
+     *  Computes the determinant and inverse of an N x N matrix by elimination, like the dynamic matrix, over loops of constant length.
+     *  Specializations give closed forms for N up to 4.
+     */
+
+    template <typename T1, size_t N>
+    struct fixed_inverse {
+
+        template <typename M>
+        static T1 determinant(const M &m) {
+            T1 a[N][N];
+            for(size_t i = 0; i < N; ++ i)
+                for(size_t j = 0; j < N; ++ j)
+                    a[i][j] = T1(m(i,j));
+
+            T1 res = T1(1);
+
+            for(size_t i = 0, j; i < N; ++ i) {
+                for(j = i; j < N && a[j][i] == T1(0); ++ j);
+                if(j == N) return T1(0);
+                if(i != j) {
+                    for(size_t k = i; k < N; ++ k)
+                        std::swap(a[i][k], a[j][k]);
+                    res = -res;
+                }
+                for(j = i + 1; j < N; ++ j) {
+                    T1 entry = a[j][i] / a[i][i];
+                    for(size_t k = i; k < N; ++ k)
+                        a[j][k] = a[j][k] - a[i][k] * entry;
+                }
+                res = res * a[i][i];
+            }
+
+            return res;
+        }
+
+        template <typename M, typename R>
+        static void inverse(const M &m, R &ret) {
+            T1 a[N][N];
+            for(size_t i = 0; i < N; ++ i)
+                for(size_t j = 0; j < N; ++ j) {
+                    a[i][j] = T1(m(i,j));
+                    ret(i,j) = T1(i == j);
+                }
+
+            for(size_t i = 0, j; i < N; ++ i) {
+                for(j = i; j < N && a[j][i] == T1(0); ++ j);
+                if(j == N) throw degenerate_matrix_error();
+                if(i != j) {
+                    for(size_t k = 0; k < N; ++ k) {
+                        std::swap(a[i][k], a[j][k]);
+                        std::swap(ret(i,k), ret(j,k));
+                    }
+                }
+                T1 pivot = a[i][i];
+                for(size_t k = 0; k < N; ++ k) {
+                    a[i][k] = a[i][k] / pivot;
+                    ret(i,k) = ret(i,k) / pivot;
+                }
+                for(j = 0; j < N; ++ j) {
+                    if(j == i) continue;
+                    T1 entry = a[j][i];
+                    for(size_t k = 0; k < N; ++ k) {
+                        a[j][k] = a[j][k] - a[i][k] * entry;
+                        ret(j,k) = ret(j,k) - ret(i,k) * entry;
+                    }
+                }
+            }
+        }
+    };
+
+    template <typename T1>
+    struct fixed_inverse<T1, 1> {
 
-    public:
+        template <typename M>
+        static T1 determinant(const M &m) {
+            return T1(m(0,0));
+        }
 
-    virtual const char* what() const throw() {
-      return "Attempted to take the inverse of degenerate matrix!";
-    }
-};
+        template <typename M, typename R>
+        static void inverse(const M &m, R &ret) {
+            if(T1(m(0,0)) == T1(0)) throw degenerate_matrix_error();
+            ret(0,0) = T1(1) / T1(m(0,0));
+        }
+    };
+
+    template <typename T1>
+    struct fixed_inverse<T1, 2> {
+
+        template <typename M>
+        static T1 determinant(const M &m) {
+            return T1(m(0,0)) * T1(m(1,1)) - T1(m(0,1)) * T1(m(1,0));
+        }
+
+        template <typename M, typename R>
+        static void inverse(const M &m, R &ret) {
+            T1 det = determinant(m);
+            if(det == T1(0)) throw degenerate_matrix_error();
+            ret(0,0) = T1(m(1,1)) / det;
+            ret(0,1) = -T1(m(0,1)) / det;
+            ret(1,0) = -T1(m(1,0)) / det;
+            ret(1,1) = T1(m(0,0)) / det;
+        }
+    };
+
+    // The inverse is the adjugate divided by the determinant. Entry (i, j) of the adjugate is the cofactor of entry (j, i).
+
+    template <typename T1>
+    struct fixed_inverse<T1, 3> {
+
+        template <typename M>
+        static T1 determinant(const M &m) {
+            T1 a00 = m(0,0), a01 = m(0,1), a02 = m(0,2);
+            T1 a10 = m(1,0), a11 = m(1,1), a12 = m(1,2);
+            T1 a20 = m(2,0), a21 = m(2,1), a22 = m(2,2);
+
+            return a00 * (a11 * a22 - a12 * a21) + a01 * (a12 * a20 - a10 * a22) + a02 * (a10 * a21 - a11 * a20);
+        }
+
+        template <typename M, typename R>
+        static void inverse(const M &m, R &ret) {
+            T1 a00 = m(0,0), a01 = m(0,1), a02 = m(0,2);
+            T1 a10 = m(1,0), a11 = m(1,1), a12 = m(1,2);
+            T1 a20 = m(2,0), a21 = m(2,1), a22 = m(2,2);
+
+            T1 c00 = a11 * a22 - a12 * a21, c10 = a12 * a20 - a10 * a22, c20 = a10 * a21 - a11 * a20;
+            T1 det = a00 * c00 + a01 * c10 + a02 * c20;
+            if(det == T1(0)) throw degenerate_matrix_error();
+
+            ret(0,0) = c00 / det;
+            ret(0,1) = (a02 * a21 - a01 * a22) / det;
+            ret(0,2) = (a01 * a12 - a02 * a11) / det;
+            ret(1,0) = c10 / det;
+            ret(1,1) = (a00 * a22 - a02 * a20) / det;
+            ret(1,2) = (a02 * a10 - a00 * a12) / det;
+            ret(2,0) = c20 / det;
+            ret(2,1) = (a01 * a20 - a00 * a21) / det;
+            ret(2,2) = (a00 * a11 - a01 * a10) / det;
+        }
+    };
+
+    // Laplace expansion along the top two rows: s holds the 2 x 2 minors of rows 0 and 1, and c those of rows 2 and 3.
+
+    template <typename T1>
+    struct fixed_inverse<T1, 4> {
+
+        template <typename M>
+        static T1 determinant(const M &m) {
+            T1 s[6], c[6];
+            minors(m, s, c);
+            return s[0] * c[5] - s[1] * c[4] + s[2] * c[3] + s[3] * c[2] - s[4] * c[1] + s[5] * c[0];
+        }
+
+        template <typename M, typename R>
+        static void inverse(const M &m, R &ret) {
+            T1 s[6], c[6];
+            minors(m, s, c);
+
+            T1 det = s[0] * c[5] - s[1] * c[4] + s[2] * c[3] + s[3] * c[2] - s[4] * c[1] + s[5] * c[0];
+            if(det == T1(0)) throw degenerate_matrix_error();
+
+            T1 a[4][4];
+            for(size_t i = 0; i < 4; ++ i)
+                for(size_t j = 0; j < 4; ++ j)
+                    a[i][j] = T1(m(i,j));
+
+            ret(0,0) = ( a[1][1] * c[5] - a[1][2] * c[4] + a[1][3] * c[3]) / det;
+            ret(0,1) = (-a[0][1] * c[5] + a[0][2] * c[4] - a[0][3] * c[3]) / det;
+            ret(0,2) = ( a[3][1] * s[5] - a[3][2] * s[4] + a[3][3] * s[3]) / det;
+            ret(0,3) = (-a[2][1] * s[5] + a[2][2] * s[4] - a[2][3] * s[3]) / det;
+            ret(1,0) = (-a[1][0] * c[5] + a[1][2] * c[2] - a[1][3] * c[1]) / det;
+            ret(1,1) = ( a[0][0] * c[5] - a[0][2] * c[2] + a[0][3] * c[1]) / det;
+            ret(1,2) = (-a[3][0] * s[5] + a[3][2] * s[2] - a[3][3] * s[1]) / det;
+            ret(1,3) = ( a[2][0] * s[5] - a[2][2] * s[2] + a[2][3] * s[1]) / det;
+            ret(2,0) = ( a[1][0] * c[4] - a[1][1] * c[2] + a[1][3] * c[0]) / det;
+            ret(2,1) = (-a[0][0] * c[4] + a[0][1] * c[2] - a[0][3] * c[0]) / det;
+            ret(2,2) = ( a[3][0] * s[4] - a[3][1] * s[2] + a[3][3] * s[0]) / det;
+            ret(2,3) = (-a[2][0] * s[4] + a[2][1] * s[2] - a[2][3] * s[0]) / det;
+            ret(3,0) = (-a[1][0] * c[3] + a[1][1] * c[1] - a[1][2] * c[0]) / det;
+            ret(3,1) = ( a[0][0] * c[3] - a[0][1] * c[1] + a[0][2] * c[0]) / det;
+            ret(3,2) = (-a[3][0] * s[3] + a[3][1] * s[1] - a[3][2] * s[0]) / det;
+            ret(3,3) = ( a[2][0] * s[3] - a[2][1] * s[1] + a[2][2] * s[0]) / det;
+        }
+
+        private:
+
+        template <typename M>
+        static void minors(const M &m, T1 *s, T1 *c) {
+            s[0] = T1(m(0,0)) * T1(m(1,1)) - T1(m(1,0)) * T1(m(0,1));
+            s[1] = T1(m(0,0)) * T1(m(1,2)) - T1(m(1,0)) * T1(m(0,2));
+            s[2] = T1(m(0,0)) * T1(m(1,3)) - T1(m(1,0)) * T1(m(0,3));
+            s[3] = T1(m(0,1)) * T1(m(1,2)) - T1(m(1,1)) * T1(m(0,2));
+            s[4] = T1(m(0,1)) * T1(m(1,3)) - T1(m(1,1)) * T1(m(0,3));
+            s[5] = T1(m(0,2)) * T1(m(1,3)) - T1(m(1,2)) * T1(m(0,3));
+            c[0] = T1(m(2,0)) * T1(m(3,1)) - T1(m(3,0)) * T1(m(2,1));
+            c[1] = T1(m(2,0)) * T1(m(3,2)) - T1(m(3,0)) * T1(m(2,2));
+            c[2] = T1(m(2,0)) * T1(m(3,3)) - T1(m(3,0)) * T1(m(2,3));
+            c[3] = T1(m(2,1)) * T1(m(3,2)) - T1(m(3,1)) * T1(m(2,2));
+            c[4] = T1(m(2,1)) * T1(m(3,3)) - T1(m(3,1)) * T1(m(2,3));
+            c[5] = T1(m(2,2)) * T1(m(3,3)) - T1(m(3,2)) * T1(m(2,3));
+        }
+    };
+}
 
 /**
- *  matrix class, for representation and manipulation of matrices
+ *  Fixed-size matrix class, for small matrices whose dimensions are known at compile time, such as 3 x 3 rotations.
+ *
+ *  The entries are stored inline, row-major, so a fixed-size matrix lives wherever it is declared and never allocates.
+ *  Every loop has a constant length, so the compiler unrolls it, and determinants and inverses up to 4 x 4 have closed forms.
+ *  Arithmetic is computed immediately: for matrices this small, expression templates would save nothing.
+ *  Explicit constructors convert to and from the dynamic matrix<T>.
  *
  *  @param T the data type being stored in the matrix.
+ *  @param R the number of rows.
+ *  @param C the number of columns.
  */
 
-template <typename T = int>
+template <typename T, size_t R, size_t C>
 class matrix {
 
+    static_assert(R > 0 && C > 0, "a fixed-size matrix needs at least one row and one column; use matrix<T> for dimensions chosen at run time");
+
     private:
 
-    std::vector<std::vector<T>> data;
+    // The entries, row-major. Entry (i, j) is at i * C + j.
+
+    T entries[R * C];
 
     public:
 
     /**
      *  Default matrix constructor. All entries are set to their default.
-     *
-     *  @param Rows the number of rows in the matrix.
-     *  @param Columns the number of columns in the matrix.
      */
 
-    inline matrix (size_t Rows, size_t Columns) {
-        for(size_t i = 0; i < Rows; ++ i) {
-            data.push_back(std::vector<T>(Columns, T()));
-        }
-    }
+    constexpr matrix (): entries() {}
 
     /**
      *  Alternate matrix constructor. All entries are set to t.
      *
-     *  @param Rows the number of rows in the matrix.
-     *  @param Columns the number of columns in the matrix.
      *  @param t the value to set all entries equal to.
      */
 
-    inline matrix (size_t Rows, size_t Columns, T t) {
-        for(size_t i = 0; i < Rows; ++ i) {
-            data.emplace_back(Columns, t);
-        }
+    explicit matrix (T t) {
+        std::fill(entries, entries + R * C, t);
     }
 
     /**
-     *  Copy constructor.
+     *  Constructs a matrix from its entries, listed row by row.
      *
-     *  @param m the matrix to copy.
+     *  @param list the R * C entries.
      */
-        
-    inline matrix (const matrix<T> &m) {
-        for(size_t i = 0; i < m.rows(); ++ i) {
-            data.push_back(std::vector<T>());
-            for(size_t j = 0; j < m.columns(); ++ j) {
-                data[i].push_back(m(i,j));
-            }
-        }
+
+    matrix (std::initializer_list<T> list) {
+        assert(list.size() == R * C);
+        std::copy(list.begin(), list.end(), entries);
     }
 
     /**
-     *  Returns the identity matrix of size N x N.
+     *  Converting constructor, from a fixed-size matrix of another data type.
      *
-     *  @return a N x N identity matrix, if such a matrix is valid.
+     *  @param m the matrix to convert.
      */
 
-    static inline matrix<T> identity(size_t N) {
-        matrix<T>ret = matrix(N, N, T(0));
+    template <typename U>
+    explicit matrix (const matrix<U, R, C> &m) {
+        std::copy(m.data(), m.data() + R * C, entries);
+    }
 
-        for(size_t i = 0; i < N; ++ i)
+    /**
+     *  Converting constructor, from a dynamic matrix with R rows and C columns.
+     *
+     *  @param m the matrix to convert.
+     */
+
+    template <typename U>
+    explicit matrix (const matrix<U> &m) {
+        assert(m.rows() == R && m.columns() == C);
+        std::copy(m.data(), m.data() + R * C, entries);
+    }
+
+    /**
+     *  Returns the identity matrix.
+     *
+     *  @return the R x R identity matrix.
+     */
+
+    static inline matrix identity() {
+        static_assert(R == C, "only square matrices have an identity");
+
+        matrix ret;
+
+        for(size_t i = 0; i < R; ++ i)
             ret(i,i) = 1;
 
         return ret;
@@ -108,30 +1631,76 @@ class matrix {
     /**
      *  Retrieves the number of rows in the matrix.
      *
-     *  @return the number of rows in the matrix.
+     *  @return R.
      */
 
-    inline size_t rows() const {
-        if(data.empty()) {
-            return 0;
-        }
-        return data.size();
+    static constexpr size_t rows() {
+        return R;
     }
 
-
     /**
      *  Retrieves the number of columns in the matrix.
      *
-     *  @return the number of columns in the matrix.
+     *  @return C.
      */
 
-    inline size_t columns() const {
-        if(data.empty()) {
-            return 0;
-        }
-        return data[0].size();
+    static constexpr size_t columns() {
+        return C;
+    }
+
+    /**
+     *  Retrieves the distance between the starts of consecutive rows in data().
+     *
+     *  @return C.
+     */
+
+    static constexpr size_t stride() {
+        return C;
+    }
+
+    /**
+     *  Allows direct access to the storage.
+     *
+     *  @return a pointer to entry (0, 0). Entry (i, j) is at data()[i * C + j].
+     */
+
+    inline T *data() {
+        return entries;
+    }
+
+    /**
+     *  Allows direct access to the storage.
+     *
+     *  @return a const pointer to entry (0, 0). Entry (i, j) is at data()[i * C + j].
+     */
+
+    constexpr const T *data() const {
+        return entries;
+    }
+
+    /**
+     *  Allows access to the matrix entries.
+     *
+     *  @param row the row the entry is in.
+     *  @param column the column the entry is in.
+     *  @return a reference corresponding the the [row][column]-th element of the matrix.
+     */
+
+    inline T &operator () (size_t row, size_t column) {
+        return entries[row * C + column];
     }
 
+    /**
+     *  Allows access to the matrix entries.
+     *
+     *  @param row the row the entry is in.
+     *  @param column the column the entry is in.
+     *  @return a const_reference corresponding to the [row][column]-th element of the matrix.
+     */
+
+    constexpr const T &operator () (size_t row, size_t column) const {
+        return entries[row * C + column];
+    }
 
     /**
      *  Adds two matrices together and returns their result
@@ -140,16 +1709,11 @@ class matrix {
      *  @return the sum of the two matrices.
      */
 
-    inline matrix<T> operator + (const matrix<T> &m) const {
-        assert(rows() == m.rows() && columns() == m.columns());
+    inline matrix operator + (const matrix &m) const {
+        matrix ret;
 
-        matrix<T> ret;
-
-        for(size_t i = 0; i < rows(); ++ i) {
-            for(size_t j = 0; j < columns(); ++ j) {
-                ret[i][j] = data[i][j] + m[i][j];
-            }
-        }
+        for(size_t i = 0; i < R * C; ++ i)
+            ret.entries[i] = entries[i] + m.entries[i];
 
         return ret;
     }
@@ -160,14 +1724,11 @@ class matrix {
      *  @return the matrix scaled by -1.
      */
 
-    inline matrix<T> operator - () const {
-        matrix<T> ret;
+    inline matrix operator - () const {
+        matrix ret;
 
-        for(size_t i = 0; i < rows(); ++ i) {
-            for(size_t j = 0; j < columns(); ++ j) {
-                ret(i,j) = -data[i][j];
-            }
-        }
+        for(size_t i = 0; i < R * C; ++ i)
+            ret.entries[i] = -entries[i];
 
         return ret;
     }
@@ -179,8 +1740,13 @@ class matrix {
      *  @return the difference of the two matrices.
      */
 
-    inline matrix<T> operator - (const matrix<T> &m) const {
-        return (*this) + -m;
+    inline matrix operator - (const matrix &m) const {
+        matrix ret;
+
+        for(size_t i = 0; i < R * C; ++ i)
+            ret.entries[i] = entries[i] - m.entries[i];
+
+        return ret;
     }
 
     /**
@@ -190,12 +1756,11 @@ class matrix {
      *  @return the matrix scaled by t.
      */
 
-    inline matrix<T> operator * (const T t) const {
-        matrix<T> ret(*this);
+    inline matrix operator * (const T t) const {
+        matrix ret;
 
-        for(size_t i = 0; i < rows(); ++ i)
-            for(size_t j = 0; j < columns(); ++ j)
-                ret(i,j) = ret(i,j) * t;
+        for(size_t i = 0; i < R * C; ++ i)
+            ret.entries[i] = entries[i] * t;
 
         return ret;
     }
@@ -203,140 +1768,98 @@ class matrix {
     /**
      *  Multiplies two matrices together and returns their result.
      *
-     *  @param m the matrix to multiply by.
-     *  @return the result of multiplying the two matrices.
+     *  @param m the matrix to multiply by, with C rows.
+     *  @return the R x K product.
      */
 
-    inline matrix<T> operator * (const matrix<T> & m) const {
-        assert(columns() == m.rows());
+    template <size_t K>
+    inline matrix<T, R, K> operator * (const matrix<T, C, K> &m) const {
+        matrix<T, R, K> ret;
 
-        matrix<T> ret = matrix(rows(), m.columns(), T(0));
-
-        // The unusual order of loops is an optimization
-
-        for(size_t i = 0; i < rows(); ++ i) {
-            for(size_t k = 0; k < columns(); ++ k) {
-                for(size_t j = 0; j < m.columns(); ++ j) {
-                    ret(i,j) = ret(i, j) + data[i][k] * m(k,j);
-                }
+        for(size_t i = 0; i < R; ++ i)
+            for(size_t j = 0; j < K; ++ j) {
+                T sum = entries[i * C] * m(0,j);
+                for(size_t k = 1; k < C; ++ k)
+                    sum = sum + entries[i * C + k] * m(k,j);
+                ret(i,j) = sum;
             }
-        }
 
         return ret;
     }
 
     /**
-     *  Computes the inverse of the matrix.
+     *  Adds a matrix to this one in place.
      *
-     *  @param T1 the data type of the inverted matrix.
-     *  @return the inverse matrix.
-     *  @throws degenernate_matrix_error if the matrix is degenerate
+     *  @param m the matrix to add.
+     *  @return this matrix.
      */
 
-    template<typename T1 = long double>
-    inline matrix<T1> inverse() const {
-        assert(rows() == columns());
+    inline matrix &operator += (const matrix &m) {
+        for(size_t i = 0; i < R * C; ++ i)
+            entries[i] = entries[i] + m.entries[i];
 
-        matrix<T1> tmp = matrix(*this);
-        matrix<T1> ret = matrix<T1>::identity(rows());
+        return *this;
+    }
 
-        // This is where the fun starts...
+    /**
+     *  Subtracts a matrix from this one in place.
+     *
+     *  @param m the matrix to subtract.
+     *  @return this matrix.
+     */
 
-        for(size_t i = 0, j; i < rows(); ++ i) {
-            for(j = i; j < rows() && tmp(j,i) == T1(0); ++ j);
-            if(j == rows()) {
-                throw degenerate_matrix_error();
-            }
-            if(i != j) {
-                for(size_t k = i; k < columns(); ++ k) {
-                    std::swap(tmp(i,k), tmp(j,k));
-                    std::swap(ret(i,k), ret(j,k));
-                }
-            }
-            for(int j = 0; j < columns(); ++ j) {
-                if(j == i) continue;
-                tmp(i,j) = tmp(i,j) / tmp(i,i);
-                ret(i,j) = ret(i,j) / tmp(i,i);
-            }
-            ret(i,i) = ret(i,i) / tmp(i,i);
-            tmp(i,i) = 1.0;
-            for(j = 0; j < rows(); ++ j) {
-                if(j == i) continue;
-                T1 entry = tmp(j,i);
-                for(size_t k = 0; k < columns(); ++k) {
-                    tmp(j,k) = tmp(j,k) - (tmp(i,k) / tmp(i,i)) * entry;
-                    ret(j,k) = ret(j,k) - (ret(i,k) / tmp(i,i)) * entry;
-                }
-            }
-        }
+    inline matrix &operator -= (const matrix &m) {
+        for(size_t i = 0; i < R * C; ++ i)
+            entries[i] = entries[i] - m.entries[i];
 
-        return ret;
+        return *this;
     }
 
     /**
-     *  Computes the matrix determinant.
+     *  Scales this matrix by a constant factor in place.
      *
-     *  @param T1 the data type of the determinant.
-     *  @return the determinant.
+     *  @param t the constant to scale the matrix by.
+     *  @return this matrix.
      */
 
-    template<typename T1 = long double>
-    inline T1 determinant() const {
-        assert(rows() == columns());
+    inline matrix &operator *= (const T t) {
+        for(size_t i = 0; i < R * C; ++ i)
+            entries[i] = entries[i] * t;
 
-        matrix<T1> tmp = matrix(*this);
+        return *this;
+    }
 
-        T1 res = T1(1);
+    /**
+     *  Computes the inverse of the matrix.
+     *
+     *  @param T1 the data type of the inverted matrix.
+     *  @return the inverse matrix.
+     *  @throws degenernate_matrix_error if the matrix is degenerate
+     */
 
-        bool b = 0;
+    template <typename T1 = long double>
+    inline matrix<T1, R, C> inverse() const {
+        static_assert(R == C, "only square matrices have an inverse");
 
-        for(size_t i = 0, j; i < rows() - 1; ++ i) {
-            for(j = i; j < rows() && tmp(j,i) == T1(0); ++ j);
-            if(j == rows()) {
-                return T1(0);
-            }
-            if(i != j) {
-                for(size_t k = i; k < columns(); ++ k) {
-                    std::swap(tmp(i,k), tmp(j,k));
-                }
-                b ^= 1;
-            }
-            for(j = i + 1; j < rows(); ++ j) {
-                T entry = tmp(j,i);
-                for(size_t k = i; k < columns(); ++ k) {
-                    tmp(j,k) = tmp(j,k) - (tmp(i,k) / tmp(i,i)) * entry;
-                }
-            }
-        }
+        matrix<T1, R, C> ret;
 
-        for(size_t i = 0; i < rows(); ++ i)
-            res = res * tmp(i,i);
+        matrix_detail::fixed_inverse<T1, R>::inverse(*this, ret);
 
-        return b ? -res : res;
+        return ret;
     }
 
     /**
-     *  Allows access to the matrix entries.
+     *  Computes the matrix determinant.
      *
-     *  @param row the row the entry is in.
-     *  @param column the column the entry is in.
-     *  @return a reference corresponding the the [row][column]-th element of the matrix.
+     *  @param T1 the data type of the determinant.
+     *  @return the determinant.
      */
 
-    inline T &operator () (size_t row, size_t column) {
-        return data[row][column];
-    }
-
-    /**
-     *  Allows access to the matrix entries.
-     *  
-     *  @param row the row the entry is in.
-     *  @param column the column the entry is in.
-     *  @return a const_reference corresponding to the [row][column]-th element of the matrix.
-     */
+    template <typename T1 = long double>
+    inline T1 determinant() const {
+        static_assert(R == C, "only square matrices have a determinant");
 
-    inline const T &operator () (size_t row, size_t column) const {
-        return data[row][column];
+        return matrix_detail::fixed_inverse<T1, R>::determinant(*this);
     }
 
     /**
@@ -346,12 +1869,10 @@ class matrix {
      *  @return true if the two are not equal, and false otherwise.
      */
 
-    inline bool operator != (const matrix<T> &m) const {
-        if(rows() != m.rows() || columns() != m.columns()) return true;
-        for(size_t i = 0; i < rows(); ++ i)
-            for(size_t j = 0; j < columns(); ++ j)
-                if(data[i][j] != m[i][j])
-                    return true;
+    inline bool operator != (const matrix &m) const {
+        for(size_t i = 0; i < R * C; ++ i)
+            if(entries[i] != m.entries[i])
+                return true;
         return false;
     }
 
@@ -360,9 +1881,9 @@ class matrix {
      *
      *  @param m the matrix to compare to.
      *  @return true if the two are equal, and false otherwise.
-    */
+     */
 
-    inline bool operator == (const matrix<T> &m) const {
+    inline bool operator == (const matrix &m) const {
         return !((*this) != m);
     }
 
@@ -372,17 +1893,54 @@ class matrix {
      *  @return the transposed matrix.
      */
 
-    inline matrix transpose() const {
-        matrix ret = matrix(columns(), rows());
+    inline matrix<T, C, R> transpose() const {
+        matrix<T, C, R> ret;
 
-        for(size_t i = 0; i < rows(); ++ i)
-            for(size_t j = 0; j < columns(); ++ j)
-                ret(j,i) = data[i][j];
+        for(size_t i = 0; i < R; ++ i)
+            for(size_t j = 0; j < C; ++ j)
+                ret(j,i) = entries[i * C + j];
 
         return ret;
     }
 };
 
+/**
+ *  Checks if two results of matrix arithmetic, or a matrix and a result, are equal to each other.
+ *  Comparisons of two plain matrices use the friend of matrix<T>.
+ *
+ *  @param l the left operand.
+ *  @param r the right operand.
+ *  @return true if the two have the same shape and entries, and false otherwise.
+ */
+
+template <typename L, typename R>
+inline typename std::enable_if<matrix_detail::kind<L>::value >= 0 && matrix_detail::kind<R>::value >= 0 &&
+        (matrix_detail::is_expression<L>::value || matrix_detail::is_expression<R>::value), bool>::type operator == (const L &l, const R &r) {
+    // Element-wise nodes compare entry by entry with nothing computed. Products are computed once each.
+    typename matrix_detail::operand<L>::type x = matrix_detail::operand<L>::get(l);
+    typename matrix_detail::operand<R>::type y = matrix_detail::operand<R>::get(r);
+
+    if(x.rows() != y.rows() || x.columns() != y.columns()) return false;
+    for(size_t i = 0; i < x.rows() * x.columns(); ++ i)
+        if(x[i] != y[i])
+            return false;
+    return true;
+}
+
+/**
+ *  Checks if two results of matrix arithmetic, or a matrix and a result, are not equal to each other.
+ *
+ *  @param l the left operand.
+ *  @param r the right operand.
+ *  @return true if the two differ in shape or in any entry, and false otherwise.
+ */
+
+template <typename L, typename R>
+inline typename std::enable_if<matrix_detail::kind<L>::value >= 0 && matrix_detail::kind<R>::value >= 0 &&
+        (matrix_detail::is_expression<L>::value || matrix_detail::is_expression<R>::value), bool>::type operator != (const L &l, const R &r) {
+    return !(l == r);
+}
+
 /**
  *  Override to print a matrix with an std::ostream.
  *
@@ -391,8 +1949,8 @@ class matrix {
  *  @return out.
  */
 
-template <typename T>
-std::ostream& operator <<(std::ostream &out, const matrix<T> &m){
+template <typename T, size_t R, size_t C>
+std::ostream& operator <<(std::ostream &out, const matrix<T, R, C> &m){
     for(size_t i = 0; i < m.rows(); ++ i){
         for(size_t j = 0; j < m.columns(); ++ j) {
             out << m(i,j);
@@ -405,4 +1963,17 @@ std::ostream& operator <<(std::ostream &out, const matrix<T> &m){
     return out;
 }
 
+/**
+ *  Override to print the result of matrix arithmetic with an std::ostream.
+ *
+ *  @param out the ostream to print on.
+ *  @param e the expression to print.
+ *  @return out.
+ */
+
+template <typename E>
+typename std::enable_if<matrix_detail::is_expression<E>::value, std::ostream &>::type operator <<(std::ostream &out, const E &e) {
+    return out << matrix<typename E::value_type>(e);
+}
+
 #endif
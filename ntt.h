@@ -0,0 +1,514 @@
+/**
+ * ntt.h
+ * Purpose: Number Theoretic Transform library, for exact integer convolution
+ *
+ * @author Kirito Feng
+ * @version 1.0
+ */
+
+#ifndef NTT_H
+
+#define NTT_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "fft.h"
+
+/**
+ * Internal helpers for ntt.h. Nothing in this namespace is part of the interface.
+ */
+
+namespace ntt_detail {
+
+    /**
+     *  Computes the inverse of an odd number modulo 2^32, by Newton's iteration.
+     *
+     *  @param m the odd number to invert.
+     *  @param x the current approximation, correct in its low bits.
+     *  @param i the number of iterations left. Each one doubles the number of correct bits.
+     *  @return m^-1 mod 2^32.
+     */
+
+    constexpr uint32_t inverse32(uint32_t m, uint32_t x = 1, int i = 5) {
+        return i == 0 ? x : inverse32(m, x * (2 - m * x), i - 1);
+    }
+
+    /**
+     *  Computes b^e mod Mod.
+     */
+
+    constexpr uint32_t power(uint64_t b, uint64_t e, uint32_t Mod) {
+        return e == 0 ? 1 : uint32_t((e & 1 ? b : 1) * power(b * b % Mod, e >> 1, Mod) % Mod);
+    }
+
+    /**
+     *  Montgomery arithmetic modulo an odd prime below 2^30, with R = 2^32.
+     *
+     *  The product of a value in normal form and a value in Montgomery form is in normal form, so the transforms keep their data in normal form and only their twiddle factors in Montgomery form.
+     */
+
+    template <uint32_t Mod>
+    struct montgomery {
+        static_assert(Mod % 2 == 1 && Mod < (1u << 30), "the modulus must be odd and below 2^30");
+
+        /**
+         *  -Mod^-1 mod 2^32.
+         */
+
+        static constexpr uint32_t ninv = uint32_t(0) - inverse32(Mod);
+
+        /**
+         *  R^2 mod Mod, which converts to Montgomery form.
+         */
+
+        static constexpr uint32_t r2 = uint32_t((uint64_t(-1) % Mod + 1) % Mod);
+
+        /**
+         *  Computes x R^-1 mod Mod.
+         *
+         *  @param x a value below Mod * 2^32.
+         *  @return x R^-1 mod Mod, in [0, Mod).
+         */
+
+        static inline uint32_t reduce(uint64_t x) {
+            uint32_t r = lazy_reduce(x);
+            return r >= Mod ? r - Mod : r;
+        }
+
+        /**
+         *  Computes x R^-1 mod Mod, without the final correction.
+         *
+         *  @param x a value below Mod * 2^32.
+         *  @return a value in [0, 2 Mod) congruent to x R^-1.
+         */
+
+        static inline uint32_t lazy_reduce(uint64_t x) {
+            return uint32_t((x + uint64_t(uint32_t(x) * ninv) * Mod) >> 32);
+        }
+
+        /**
+         *  Computes a b R^-1 mod Mod.
+         */
+
+        static inline uint32_t mul(uint32_t a, uint32_t b) {
+            return reduce(uint64_t(a) * b);
+        }
+
+        /**
+         *  Converts a value in normal form to Montgomery form.
+         */
+
+        static inline uint32_t to(uint32_t a) {
+            return mul(a, r2);
+        }
+    };
+
+    /**
+     *  Signature of the kernels computing one radix-2 stage of an NTT.
+     *
+     *  @param P the data, of length N, in bit-reversed order before the first stage.
+     *  @param w the twiddle factors of the stage, in Montgomery form.
+     *  @param N the length of the transform.
+     *  @param h the half-length of the butterflies of the stage.
+     */
+
+    typedef void (*ntt_stage_kernel)(uint32_t *P, const uint32_t *w, size_t N, size_t h);
+
+    // The butterflies reduce lazily, keeping every value in [0, 4 Mod), which fits in 32 bits because Mod < 2^30.
+    // The comparisons become min(x, x - 2 Mod), which has no branch.
+
+    template <uint32_t Mod>
+    void ntt_stage_scalar(uint32_t *P, const uint32_t *w, size_t N, size_t h) {
+        for(size_t j = 0; j < N; j += 2 * h) {
+            for(size_t k = 0; k < h; ++ k) {
+                uint32_t u = P[j + k], v = montgomery<Mod>::lazy_reduce(uint64_t(P[j + k + h]) * w[k]);
+                u = std::min(u, u - 2 * Mod);
+                P[j + k] = u + v;
+                P[j + k + h] = u - v + 2 * Mod;
+            }
+        }
+    }
+
+#ifdef FFT_X86_SIMD
+
+    // The vector kernels form the 64-bit products of the even and odd lanes separately, reduce both, and merge the high halves.
+
+    __attribute__((target("avx2")))
+    inline __m256i lazy_reduce_avx2(__m256i a, __m256i w, __m256i ninv, __m256i mod) {
+        __m256i even = _mm256_mul_epu32(a, w);
+        __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(w, 32));
+        even = _mm256_add_epi64(even, _mm256_mul_epu32(_mm256_mul_epu32(even, ninv), mod));
+        odd = _mm256_add_epi64(odd, _mm256_mul_epu32(_mm256_mul_epu32(odd, ninv), mod));
+        return _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+    }
+
+    template <uint32_t Mod>
+    __attribute__((target("avx2")))
+    void ntt_stage_avx2(uint32_t *P, const uint32_t *w, size_t N, size_t h) {
+        const __m256i ninv = _mm256_set1_epi32(int(montgomery<Mod>::ninv)), mod = _mm256_set1_epi32(int(Mod)), mod2 = _mm256_set1_epi32(int(2 * Mod));
+
+        for(size_t j = 0; j < N; j += 2 * h) {
+            for(size_t k = 0; k < h; k += 8) {
+                __m256i u = _mm256_loadu_si256((const __m256i *) (P + j + k));
+                __m256i v = lazy_reduce_avx2(_mm256_loadu_si256((const __m256i *) (P + j + k + h)), _mm256_loadu_si256((const __m256i *) (w + k)), ninv, mod);
+                u = _mm256_min_epu32(u, _mm256_sub_epi32(u, mod2));
+                _mm256_storeu_si256((__m256i *) (P + j + k), _mm256_add_epi32(u, v));
+                _mm256_storeu_si256((__m256i *) (P + j + k + h), _mm256_add_epi32(_mm256_sub_epi32(u, v), mod2));
+            }
+        }
+    }
+
+    // The AVX-512 kernel uses the zero-masked forms of the intrinsics, whose plain forms start from an undefined register and trip -Wmaybe-uninitialized in GCC.
+
+    __attribute__((target("avx512f")))
+    inline __m512i lazy_reduce_avx512(__m512i a, __m512i w, __m512i ninv, __m512i mod) {
+        __m512i even = _mm512_maskz_mul_epu32(0xFF, a, w);
+        __m512i odd = _mm512_maskz_mul_epu32(0xFF, _mm512_maskz_srli_epi64(0xFF, a, 32), _mm512_maskz_srli_epi64(0xFF, w, 32));
+        even = _mm512_add_epi64(even, _mm512_maskz_mul_epu32(0xFF, _mm512_maskz_mul_epu32(0xFF, even, ninv), mod));
+        odd = _mm512_add_epi64(odd, _mm512_maskz_mul_epu32(0xFF, _mm512_maskz_mul_epu32(0xFF, odd, ninv), mod));
+        return _mm512_mask_blend_epi32(0xAAAA, _mm512_maskz_srli_epi64(0xFF, even, 32), odd);
+    }
+
+    template <uint32_t Mod>
+    __attribute__((target("avx512f")))
+    void ntt_stage_avx512(uint32_t *P, const uint32_t *w, size_t N, size_t h) {
+        const __m512i ninv = _mm512_set1_epi32(int(montgomery<Mod>::ninv)), mod = _mm512_set1_epi32(int(Mod)), mod2 = _mm512_set1_epi32(int(2 * Mod));
+
+        for(size_t j = 0; j < N; j += 2 * h) {
+            for(size_t k = 0; k < h; k += 16) {
+                __m512i u = _mm512_loadu_si512(P + j + k);
+                __m512i v = lazy_reduce_avx512(_mm512_loadu_si512(P + j + k + h), _mm512_loadu_si512(w + k), ninv, mod);
+                u = _mm512_maskz_min_epu32(0xFFFF, u, _mm512_sub_epi32(u, mod2));
+                _mm512_storeu_si512(P + j + k, _mm512_add_epi32(u, v));
+                _mm512_storeu_si512(P + j + k + h, _mm512_add_epi32(_mm512_sub_epi32(u, v), mod2));
+            }
+        }
+    }
+
+    /**
+     *  Picks the widest stage kernel supported by the running CPU.
+     *
+     *  @param width set to the smallest half-length the kernel can handle. Earlier stages use the scalar kernel.
+     *  @return the selected kernel.
+     */
+
+    template <uint32_t Mod>
+    inline ntt_stage_kernel select_ntt_stage(size_t &width) {
+        switch(fft_detail::simd_level()) {
+            case 2: width = 16; return ntt_stage_avx512<Mod>;
+            case 1: width = 8; return ntt_stage_avx2<Mod>;
+            default: width = 1; return ntt_stage_scalar<Mod>;
+        }
+    }
+
+#else
+
+    template <uint32_t Mod>
+    inline ntt_stage_kernel select_ntt_stage(size_t &width) {
+        width = 1;
+        return ntt_stage_scalar<Mod>;
+    }
+
+#endif
+}
+
+/**
+ * A precomputed plan for the Number Theoretic Transform of a fixed power of two size, modulo a prime.
+ *
+ * This is the exact counterpart of fft_plan: the primitive N-th roots of unity are taken modulo Mod rather than in the complex numbers, so transforms and convolutions of integers involve no rounding.
+ * The twiddle factors and the bit-reversal permutation are computed once, when the plan is constructed, and the plan is immutable afterwards, so it may be shared between threads.
+ * Products are computed with Montgomery reduction, which needs no division.
+ *
+ * @param Mod a prime below 2^30. N must divide Mod - 1.
+ * @param G a primitive root modulo Mod.
+ */
+
+template <uint32_t Mod = 998244353, uint32_t G = 3>
+class ntt_plan {
+
+    private:
+
+    typedef ntt_detail::montgomery<Mod> mont;
+
+    std::vector<size_t> rev;
+
+    // The twiddle factors of the stage with half-length h, in Montgomery form, are stored contiguously at roots[h .. 2h), as in fft_plan.
+
+    std::vector<uint32_t> roots, iroots;
+
+    // N^-1 in Montgomery form.
+
+    uint32_t scale;
+
+    // The stage kernel, and the smallest half-length it handles.
+
+    ntt_detail::ntt_stage_kernel stage;
+
+    size_t width;
+
+    public:
+
+    /**
+     *  Constructs a plan for transforms of length N.
+     *
+     *  @param N the length of the transform. This must be a power of two dividing Mod - 1.
+     *  @throws std::length_error if N does not divide Mod - 1, so no root of unity of order N exists.
+     */
+
+    explicit ntt_plan(size_t N = 1): rev(N), roots(N), iroots(N) {
+        assert(N > 0 && (N & (N - 1)) == 0);
+
+        if((Mod - 1) % N != 0) throw std::length_error("ntt_plan: the length must divide Mod - 1");
+
+        for(size_t i = 1, j = 0; i < N; ++ i) {
+            size_t b = N >> 1;
+            while(j >= b) {
+                j -= b;
+                b >>= 1;
+            }
+            j += b;
+            rev[i] = j;
+        }
+
+        for(size_t h = 1; h < N; h <<= 1) {
+            uint32_t w = mont::to(ntt_detail::power(G, (Mod - 1) / (2 * h), Mod));
+            uint32_t iw = mont::to(ntt_detail::power(G, Mod - 1 - (Mod - 1) / (2 * h), Mod));
+            roots[h] = iroots[h] = mont::to(1);
+            for(size_t k = 1; k < h; ++ k) {
+                roots[h + k] = mont::mul(roots[h + k - 1], w);
+                iroots[h + k] = mont::mul(iroots[h + k - 1], iw);
+            }
+        }
+
+        scale = mont::to(ntt_detail::power(N, Mod - 2, Mod));
+        stage = ntt_detail::select_ntt_stage<Mod>(width);
+    }
+
+    /**
+     *  Retrieves the length of the transforms computed by the plan.
+     *
+     *  @return the length of the transform.
+     */
+
+    inline size_t size() const {
+        return rev.size();
+    }
+
+    /**
+     *  Computes the Number Theoretic Transform of size() values in caller-owned memory, in place.
+     *
+     *  @param P the first of the size() contiguous values to transform, each in [0, Mod).
+     *  @param inv pass 1 to compute the transform, and -1 to compute the inverse transform.
+     */
+
+    void execute(uint32_t *P, int inv = 1) const {
+        size_t N = size();
+
+        for(size_t i = 1; i < N; ++ i)
+            if(i < rev[i]) std::swap(P[i], P[rev[i]]);
+
+        const uint32_t *w = inv == -1 ? iroots.data() : roots.data();
+
+        for(size_t h = 1; h < N; h <<= 1)
+            (h < width ? ntt_detail::ntt_stage_scalar<Mod> : stage)(P, w + h, N, h);
+
+        const uint32_t s = inv == -1 ? scale : mont::to(1);
+
+        for(size_t i = 0; i < N; ++ i)
+            P[i] = mont::mul(P[i], s);
+    }
+
+    /**
+     *  Computes the Number Theoretic Transform of P, in place.
+     *
+     *  @param P the values to transform, each in [0, Mod). P.size() must equal size().
+     *  @param inv pass 1 to compute the transform, and -1 to compute the inverse transform.
+     */
+
+    void execute(std::vector<uint32_t> &P, int inv = 1) const {
+        assert(P.size() == size());
+
+        execute(P.data(), inv);
+    }
+};
+
+/**
+ * Retrieves an NTT plan of length N, constructing it on first use.
+ *
+ * Each thread keeps its own cache of plans, like cached_fft_plan.
+ *
+ * @param Mod the prime modulus.
+ * @param G a primitive root modulo Mod.
+ * @param N the length of the transform.
+ * @return a plan for transforms of length N.
+ */
+
+template <uint32_t Mod = 998244353, uint32_t G = 3>
+inline const ntt_plan<Mod, G> &cached_ntt_plan(size_t N) {
+    thread_local std::unordered_map<size_t, ntt_plan<Mod, G>> plans;
+
+    auto it = plans.find(N);
+    if(it == plans.end()) it = plans.emplace(N, ntt_plan<Mod, G>(N)).first;
+
+    return it->second;
+}
+
+/**
+ * Computes the linear convolution of two sequences modulo a prime, exactly.
+ *
+ * @param Mod the prime modulus.
+ * @param G a primitive root modulo Mod.
+ * The transform length is the power of two at or above a.size() + b.size() - 1, and it must divide Mod - 1: at most 2^23 for 998244353.
+ *
+ * @param a the first sequence, each value in [0, Mod).
+ * @param b the second sequence, each value in [0, Mod).
+ * @return the a.size() + b.size() - 1 values of the convolution modulo Mod, or nothing if either sequence is empty.
+ * @throws std::length_error if the convolution is too long for Mod.
+ */
+
+template <uint32_t Mod = 998244353, uint32_t G = 3>
+std::vector<uint32_t> ntt_convolve(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b) {
+    if(a.empty() || b.empty()) return std::vector<uint32_t>();
+
+    size_t L = a.size() + b.size() - 1, N = 1;
+
+    while(N < L) N <<= 1;
+
+    const ntt_plan<Mod, G> &plan = cached_ntt_plan<Mod, G>(N);
+
+    std::vector<uint32_t> A(a), B(b);
+
+    A.resize(N);
+    B.resize(N);
+
+    plan.execute(A.data(), 1);
+    plan.execute(B.data(), 1);
+
+    // A[k] B[k] R^-1 R^2 R^-1 = A[k] B[k].
+    for(size_t k = 0; k < N; ++ k)
+        A[k] = ntt_detail::montgomery<Mod>::mul(ntt_detail::montgomery<Mod>::mul(A[k], B[k]), ntt_detail::montgomery<Mod>::r2);
+
+    plan.execute(A.data(), -1);
+
+    A.resize(L);
+
+    return A;
+}
+
+namespace ntt_detail {
+
+    /**
+     *  The longest convolution convolve_pieces computes in one transform: 2^23 values, within reach of all three primes of convolve_exact.
+     */
+
+    const size_t piece_limit = size_t(1) << 23;
+
+    /**
+     *  Computes the linear convolution of two sequences modulo a prime, like ntt_convolve, but for any length.
+     *
+     *  Inputs whose convolution is too long for one transform are split into pieces. The shorter sequence is kept whole if it has at most piece_limit / 2 values, and cut in halves of the limit otherwise.
+     *  The longer one is cut into pieces that fill the rest of the transform. The convolution of each pair of pieces is added into the result at its offset.
+     *
+     *  @param a the first sequence, each value in [0, Mod).
+     *  @param b the second sequence, each value in [0, Mod).
+     *  @return the a.size() + b.size() - 1 values of the convolution modulo Mod.
+     */
+
+    template <uint32_t Mod, uint32_t G>
+    std::vector<uint32_t> convolve_pieces(const std::vector<uint32_t> &a, const std::vector<uint32_t> &b) {
+        if(a.size() + b.size() - 1 <= piece_limit) return ntt_convolve<Mod, G>(a, b);
+        if(a.size() < b.size()) return convolve_pieces<Mod, G>(b, a);
+
+        size_t pb = std::min(b.size(), piece_limit / 2), pa = piece_limit + 1 - pb;
+
+        std::vector<uint32_t> ret(a.size() + b.size() - 1, 0);
+
+        for(size_t i = 0; i < a.size(); i += pa) {
+            std::vector<uint32_t> x(a.begin() + i, a.begin() + std::min(a.size(), i + pa));
+
+            for(size_t j = 0; j < b.size(); j += pb) {
+                std::vector<uint32_t> y(b.begin() + j, b.begin() + std::min(b.size(), j + pb));
+                std::vector<uint32_t> z = ntt_convolve<Mod, G>(x, y);
+
+                uint32_t *r = ret.data() + i + j;
+                for(size_t k = 0; k < z.size(); ++ k) {
+                    uint32_t v = r[k] + z[k];
+                    r[k] = v >= Mod ? v - Mod : v;
+                }
+            }
+        }
+
+        return ret;
+    }
+}
+
+/**
+ * Computes the linear convolution of two integer sequences exactly.
+ *
+ * The convolution is computed modulo three NTT primes, 998244353, 167772161 and 469762049, and recombined with the Chinese Remainder Theorem (Garner's algorithm).
+ * The result is exact as long as every value of the true convolution lies within +/- 3.8e25. It is then returned modulo 2^64, truncated to T.
+ * The longest transform 998244353 allows has 2^23 points. Longer inputs are split into pieces, whose convolutions are summed modulo each prime before recombining,
+ * so any length is exact, at the cost of one transform per pair of pieces.
+ *
+ * @param T an integer type.
+ * @param a the first sequence.
+ * @param b the second sequence.
+ * @return the a.size() + b.size() - 1 values of the convolution, or nothing if either sequence is empty.
+ */
+
+template <typename T>
+std::vector<T> convolve_exact(const std::vector<T> &a, const std::vector<T> &b) {
+    static_assert(std::is_integral<T>::value, "convolve_exact needs an integer type");
+
+    const uint32_t m0 = 998244353, m1 = 167772161, m2 = 469762049;
+
+    if(a.empty() || b.empty()) return std::vector<T>();
+
+    auto residues = [](const std::vector<T> &x, uint32_t m) {
+        std::vector<uint32_t> r(x.size());
+        for(size_t i = 0; i < x.size(); ++ i) {
+            if(std::is_signed<T>::value) {
+                long long v = (long long) x[i] % (long long) m;
+                r[i] = uint32_t(v < 0 ? v + m : v);
+            } else {
+                r[i] = uint32_t((unsigned long long) x[i] % m);
+            }
+        }
+        return r;
+    };
+
+    std::vector<uint32_t> r0 = ntt_detail::convolve_pieces<m0, 3>(residues(a, m0), residues(b, m0));
+    std::vector<uint32_t> r1 = ntt_detail::convolve_pieces<m1, 3>(residues(a, m1), residues(b, m1));
+    std::vector<uint32_t> r2 = ntt_detail::convolve_pieces<m2, 3>(residues(a, m2), residues(b, m2));
+
+    // Garner's algorithm writes the value as x0 + m0 x1 + m0 m1 x2, with digits x0 < m0, x1 < m1 and x2 < m2.
+    // The product M = m0 m1 m2 is odd and each m - 1 is even, so (M - 1) / 2 has the digits (m0 - 1) / 2, (m1 - 1) / 2 and (m2 - 1) / 2.
+
+    const uint64_t inv01 = ntt_detail::power(m0, m1 - 2, m1);
+    const uint64_t inv012 = ntt_detail::power(uint64_t(m0) * m1 % m2, m2 - 2, m2);
+    const uint64_t M = uint64_t(m0) * m1 * m2;
+
+    std::vector<T> ret(r0.size());
+
+    for(size_t i = 0; i < ret.size(); ++ i) {
+        uint64_t x0 = r0[i];
+        uint64_t x1 = (r1[i] + m1 - x0 % m1) % m1 * inv01 % m1;
+        uint64_t x2 = (r2[i] + 2 * uint64_t(m2) - (x0 + m0 * x1) % m2) % m2 * inv012 % m2;
+
+        uint64_t v = x0 + m0 * x1 + uint64_t(m0) * m1 * x2;
+
+        bool negative = x2 != (m2 - 1) / 2 ? x2 > (m2 - 1) / 2 : x1 != (m1 - 1) / 2 ? x1 > (m1 - 1) / 2 : x0 > (m0 - 1) / 2;
+
+        ret[i] = T(negative ? v - M : v);
+    }
+
+    return ret;
+}
+
+#endif
@@ -10,10 +10,15 @@
 
 #define PHYSICS_H
 
+#include "bigint.h"
+#include "convolve.h"
 #include "fft.h"
 #include "gauss.h"
 #include "matrix.h"
+#include "ntt.h"
 #include "rot.h"
+#include "stft.h"
+#include "thread_pool.h"
 #include "vector.h"
 
 #endif
@@ -0,0 +1,289 @@
+/**
+ * stft.h
+ * Purpose: short-time Fourier transform and spectrograms
+ *
+ * @author Kirito Feng
+ * @version 1.0
+ */
+
+#ifndef STFT_H
+
+#define STFT_H
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <thread>
+#include <vector>
+
+#include "fft.h"
+
+/**
+ * Computes a periodic Hann window, the usual choice for spectral analysis.
+ *
+ * With a hop of a quarter or a half of its length, the shifted windows sum to a constant, so overlap-add reconstructs the signal exactly.
+ *
+ * @param T the floating point type of the window.
+ * @param N the length of the window.
+ * @return the N values 0.5 - 0.5 cos(2 pi j / N).
+ */
+
+template <typename T = double>
+std::vector<T> hann_window(size_t N) {
+    std::vector<T> ret(N);
+
+    for(size_t j = 0; j < N; ++ j)
+        ret[j] = T(0.5L - 0.5L * std::cos(2 * fft_detail::pi * (long double) j / (long double) N));
+
+    return ret;
+}
+
+/**
+ * A short-time Fourier transform, with a fixed window, hop and transform size.
+ *
+ * Frame m holds the window.size() samples starting at m * hop, multiplied by the window and padded with zeros to fft_size. Its bins() = fft_size / 2 + 1 values are the non-redundant half of its real transform.
+ * Frames are laid out one after the other, bins() values each, in caller-owned memory, so a spectrogram can be written into a preallocated buffer.
+ * A single rfft_plan serves every frame. The frames are spread over threads in contiguous batches, each with its own scratch buffers.
+ * Like the plans of fft.h, an stft is immutable once constructed and may be shared between threads.
+ *
+ * @param T the floating point type of the samples.
+ */
+
+template <typename T = double>
+class stft {
+
+    private:
+
+    std::vector<T> window;
+
+    size_t hop;
+
+    rfft_plan<T> plan;
+
+    unsigned threads;
+
+    /**
+     *  Computes the transforms of a range of frames, and hands each one to a callback.
+     *
+     *  @param signal the first sample of the signal.
+     *  @param count the number of frames.
+     *  @param f called as f(m, spectrum) for each frame m, where spectrum holds its bins() values. The same buffer is reused for every frame of a batch.
+     */
+
+    template <typename F>
+    void analyze(const T *signal, size_t count, const F &f) const {
+        fft_detail::parallel_for(count, threads, [&](size_t first, size_t last) {
+            std::vector<T> frame(plan.size(), T(0));
+            std::vector<std::complex<T>> spectrum(bins());
+
+            for(size_t m = first; m < last; ++ m) {
+                const T *x = signal + m * hop;
+                for(size_t j = 0; j < window.size(); ++ j)
+                    frame[j] = x[j] * window[j];
+                plan.execute(frame.data(), spectrum.data());
+                f(m, spectrum.data());
+            }
+        });
+    }
+
+    public:
+
+    /**
+     *  Constructs a short-time Fourier transform.
+     *
+     *  @param window the analysis window. Its length is the length of each frame.
+     *  @param hop the number of samples between the starts of consecutive frames.
+     *  @param fft_size the length of the transform of each frame, at least window.size(). Pass 0 to use window.size().
+     *  @param threads the number of threads the frames are spread over. Pass 0 to use every hardware thread.
+     */
+
+    stft(const std::vector<T> &window, size_t hop, size_t fft_size = 0, unsigned threads = 1): window(window), hop(hop),
+            plan(fft_size ? fft_size : window.size()), threads(threads ? threads : std::max(1u, std::thread::hardware_concurrency())) {
+        assert(!window.empty() && hop > 0 && plan.size() >= window.size());
+    }
+
+    /**
+     *  Retrieves the length of the window, which is the number of samples in each frame.
+     *
+     *  @return the length of the window.
+     */
+
+    inline size_t window_size() const {
+        return window.size();
+    }
+
+    /**
+     *  Retrieves the number of samples between consecutive frames.
+     *
+     *  @return the hop.
+     */
+
+    inline size_t hop_size() const {
+        return hop;
+    }
+
+    /**
+     *  Retrieves the length of the transform of each frame.
+     *
+     *  @return the transform size.
+     */
+
+    inline size_t fft_size() const {
+        return plan.size();
+    }
+
+    /**
+     *  Retrieves the number of values stored for each frame.
+     *
+     *  @return fft_size() / 2 + 1.
+     */
+
+    inline size_t bins() const {
+        return plan.size() / 2 + 1;
+    }
+
+    /**
+     *  Computes the number of frames that fit in a signal. Frames never extend past its end.
+     *
+     *  @param length the number of samples in the signal.
+     *  @return the number of frames.
+     */
+
+    inline size_t frames(size_t length) const {
+        return length < window.size() ? 0 : (length - window.size()) / hop + 1;
+    }
+
+    /**
+     *  Computes the short-time Fourier transform of a signal in caller-owned memory.
+     *
+     *  @param signal the first of the length samples of the signal.
+     *  @param length the number of samples.
+     *  @param out the first of frames(length) * bins() values, overwritten with the transform of each frame in turn.
+     */
+
+    void execute(const T *signal, size_t length, std::complex<T> *out) const {
+        analyze(signal, frames(length), [&](size_t m, const std::complex<T> *spectrum) {
+            std::copy(spectrum, spectrum + bins(), out + m * bins());
+        });
+    }
+
+    /**
+     *  Computes the short-time Fourier transform of a signal.
+     *
+     *  @param signal the samples of the signal.
+     *  @return the transform of each frame in turn, bins() values each.
+     */
+
+    std::vector<std::complex<T>> execute(const std::vector<T> &signal) const {
+        std::vector<std::complex<T>> ret(frames(signal.size()) * bins());
+
+        execute(signal.data(), signal.size(), ret.data());
+
+        return ret;
+    }
+
+    /**
+     *  Computes the magnitude spectrogram of a signal into caller-owned memory.
+     *
+     *  No complex spectrum is stored: each frame's magnitudes are written straight from its transform.
+     *
+     *  @param signal the first of the length samples of the signal.
+     *  @param length the number of samples.
+     *  @param out the first of frames(length) * bins() values, overwritten with the magnitudes of each frame in turn.
+     */
+
+    void magnitude(const T *signal, size_t length, T *out) const {
+        analyze(signal, frames(length), [&](size_t m, const std::complex<T> *spectrum) {
+            T *row = out + m * bins();
+            // sqrt(norm) is much faster than std::abs, which guards against overflow with hypot.
+            for(size_t k = 0; k < bins(); ++ k)
+                row[k] = std::sqrt(std::norm(spectrum[k]));
+        });
+    }
+
+    /**
+     *  Computes the magnitude spectrogram of a signal.
+     *
+     *  @param signal the samples of the signal.
+     *  @return the magnitudes of each frame in turn, bins() values each.
+     */
+
+    std::vector<T> magnitude(const std::vector<T> &signal) const {
+        std::vector<T> ret(frames(signal.size()) * bins());
+
+        magnitude(signal.data(), signal.size(), ret.data());
+
+        return ret;
+    }
+
+    /**
+     *  Computes the inverse short-time Fourier transform into caller-owned memory, by weighted overlap-add.
+     *
+     *  Each frame is inverted, multiplied by the window again and added at its position. The sum is divided by the sum of the squared windows covering each sample, which makes this the least squares inverse, and the exact inverse of an unmodified transform.
+     *  Samples no frame covers with a nonzero window weight are set to zero. Every other sample is divided by its weight, however small, so samples where the window only just starts are recovered too, though with less precision.
+     *  The frames are inverted in parallel, a batch at a time, and added in order.
+     *
+     *  @param in the first of count * bins() values, the transforms of count consecutive frames.
+     *  @param count the number of frames.
+     *  @param out the first of (count - 1) * hop_size() + window_size() samples, overwritten with the signal. Nothing is written if count is 0.
+     */
+
+    void inverse(const std::complex<T> *in, size_t count, T *out) const {
+        if(count == 0) return;
+
+        size_t length = (count - 1) * hop + window.size(), W = window.size();
+
+        std::vector<T> norm(length, T(0));
+
+        std::fill(out, out + length, T(0));
+
+        // Enough frames per batch to keep every thread busy, without holding every inverted frame at once.
+        size_t batch = std::max<size_t>(64, 4 * threads);
+
+        std::vector<T> buffer(std::min(batch, count) * plan.size());
+
+        for(size_t m0 = 0; m0 < count; m0 += batch) {
+            size_t n = std::min(batch, count - m0);
+
+            fft_detail::parallel_for(n, threads, [&](size_t first, size_t last) {
+                for(size_t m = first; m < last; ++ m)
+                    plan.execute(in + (m0 + m) * bins(), buffer.data() + m * plan.size());
+            });
+
+            for(size_t m = 0; m < n; ++ m) {
+                const T *y = buffer.data() + m * plan.size();
+                T *x = out + (m0 + m) * hop;
+                T *z = norm.data() + (m0 + m) * hop;
+                for(size_t j = 0; j < W; ++ j) {
+                    x[j] += y[j] * window[j];
+                    z[j] += window[j] * window[j];
+                }
+            }
+        }
+
+        for(size_t i = 0; i < length; ++ i)
+            out[i] = norm[i] > T(0) ? out[i] / norm[i] : T(0);
+    }
+
+    /**
+     *  Computes the inverse short-time Fourier transform, by weighted overlap-add.
+     *
+     *  @param in the transforms of consecutive frames, bins() values each. in.size() must be a multiple of bins().
+     *  @return the (count - 1) * hop_size() + window_size() samples of the signal, where count is the number of frames, or nothing if there are none.
+     */
+
+    std::vector<T> inverse(const std::vector<std::complex<T>> &in) const {
+        assert(in.size() % bins() == 0);
+
+        size_t count = in.size() / bins();
+
+        std::vector<T> ret(count ? (count - 1) * hop + window.size() : 0);
+
+        inverse(in.data(), count, ret.data());
+
+        return ret;
+    }
+};
+
+#endif
@@ -0,0 +1,256 @@
+/**
+ *  thread_pool.h
+ *  Purpose: a persistent work-stealing thread pool, shared by the parallel algorithms of the other headers
+ *
+ *  @author Kirito Feng
+ *  @version 1.0
+ */
+
+#ifndef THREAD_POOL_H
+
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ *  A fixed set of worker threads that share out the tasks of one job at a time by work stealing.
+ *
+ *  A job is a count of independent tasks. Each participant, the caller included, starts with a contiguous share of them in its own deque.
+ *  It takes tasks from the front of its own deque, and when that runs dry, steals from the back of the others', so uneven tasks still keep every thread busy.
+ *  The workers sleep between jobs, so a job costs a wake-up rather than creating threads.
+ *  If a task throws, the tasks not yet started are cancelled, and the first exception is rethrown to the caller once every running task has finished.
+ */
+
+class thread_pool {
+
+    private:
+
+    struct queue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+
+    std::vector<std::thread> workers;
+
+    std::unique_ptr<queue[]> queues;
+
+    std::mutex lock, busy;
+
+    std::condition_variable wake, finished;
+
+    const std::function<void(size_t)> *task;
+
+    size_t generation, active;
+
+    bool stop;
+
+    // The first exception thrown by a task of the current job, guarded by lock.
+    std::exception_ptr error;
+
+    /**
+     *  Flags the threads that are running a task, so a job submitted from inside a task is recognized.
+     *
+     *  @return a reference to the calling thread's flag.
+     */
+
+    static bool &in_task() {
+        thread_local bool flag = false;
+        return flag;
+    }
+
+    /**
+     *  Empties every deque, so no further task of the current job starts.
+     */
+
+    void cancel() {
+        for(size_t p = 0; p < size(); ++ p) {
+            std::lock_guard<std::mutex> guard(queues[p].lock);
+            queues[p].tasks.clear();
+        }
+    }
+
+    /**
+     *  Takes the next task for a participant: from the front of its own deque, or else from the back of another's.
+     *
+     *  @param self the index of the participant.
+     *  @param i set to the task taken.
+     *  @return whether a task was taken. false means every deque is empty.
+     */
+
+    bool next(size_t self, size_t &i) {
+        size_t n = workers.size() + 1;
+
+        for(size_t v = 0; v < n; ++ v) {
+            queue &q = queues[(self + v) % n];
+            std::lock_guard<std::mutex> guard(q.lock);
+            if(q.tasks.empty()) continue;
+            if(v == 0) {
+                i = q.tasks.front();
+                q.tasks.pop_front();
+            } else {
+                i = q.tasks.back();
+                q.tasks.pop_back();
+            }
+            return true;
+        }
+
+        return false;
+    }
+
+    void work(size_t self) {
+        size_t i;
+
+        in_task() = true;
+
+        while(next(self, i)) {
+            try {
+                (*task)(i);
+            } catch(...) {
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    if(!error) error = std::current_exception();
+                }
+                cancel();
+            }
+        }
+
+        in_task() = false;
+    }
+
+    void loop(size_t self) {
+        size_t seen = 0;
+
+        for(;;) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&]() { return stop || generation != seen; });
+                if(stop) return;
+                seen = generation;
+            }
+
+            work(self);
+
+            std::lock_guard<std::mutex> guard(lock);
+            if(-- active == 0) finished.notify_one();
+        }
+    }
+
+    public:
+
+    /**
+     *  Starts the workers.
+     *
+     *  @param threads the number of threads taking part in each job, including the caller, so threads - 1 workers are started.
+     */
+
+    explicit thread_pool(unsigned threads): queues(new queue[std::max(1u, threads)]), task(nullptr), generation(0), active(0), stop(false) {
+        for(size_t t = 1; t < threads; ++ t)
+            workers.emplace_back(&thread_pool::loop, this, t);
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = true;
+        }
+        wake.notify_all();
+        for(auto &w: workers)
+            w.join();
+    }
+
+    thread_pool(const thread_pool &) = delete;
+
+    thread_pool &operator = (const thread_pool &) = delete;
+
+    /**
+     *  Retrieves the pool shared by the whole program, with one thread per hardware thread. It is started the first time it is needed.
+     *
+     *  @return the shared pool.
+     */
+
+    static thread_pool &shared() {
+        static thread_pool pool(std::max(1u, std::thread::hardware_concurrency()));
+        return pool;
+    }
+
+    /**
+     *  Retrieves the number of threads taking part in each job, including the caller.
+     *
+     *  @return the number of threads.
+     */
+
+    inline size_t size() const {
+        return workers.size() + 1;
+    }
+
+    /**
+     *  Runs a job, with the calling thread taking part. Returns once every task has finished.
+     *
+     *  The pool runs one job at a time. A job submitted from inside a task runs its tasks in order on the calling thread.
+     *  If another thread's job is running, nothing is run and false is returned, so the caller can run the tasks itself.
+     *
+     *  @param count the number of tasks.
+     *  @param f called as f(i) once for each task i in [0, count), from any of the threads.
+     *  @return whether the job was run.
+     *  @throws the first exception thrown by a task. The tasks that had not started by then are skipped.
+     */
+
+    template <typename F>
+    bool run(size_t count, const F &f) {
+        if(in_task()) {
+            for(size_t i = 0; i < count; ++ i)
+                f(i);
+            return true;
+        }
+
+        std::unique_lock<std::mutex> claim(busy, std::try_to_lock);
+        if(!claim.owns_lock()) return false;
+
+        std::function<void(size_t)> g(f);
+        size_t n = size();
+
+        // Every worker has left the previous job, so the deques can be filled without locking them.
+        try {
+            for(size_t p = 0; p < n; ++ p)
+                for(size_t i = count * p / n; i < count * (p + 1) / n; ++ i)
+                    queues[p].tasks.push_back(i);
+        } catch(...) {
+            cancel();
+            throw;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            task = &g;
+            active = workers.size();
+            ++ generation;
+        }
+        wake.notify_all();
+
+        work(0);
+
+        std::exception_ptr thrown;
+
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            finished.wait(guard, [&]() { return active == 0; });
+            task = nullptr;
+            std::swap(thrown, error);
+        }
+
+        if(thrown) std::rethrow_exception(thrown);
+
+        return true;
+    }
+};
+
+#endif
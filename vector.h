@@ -141,12 +141,8 @@ class vector {
          * @return the vector as a column matrix.
          */
 
-        inline matrix<T> to_matrix() const {
-            matrix<T> ret = matrix<T>(3,1);
-            ret(0, 0) = x;
-            ret(0, 1) = y;
-            ret(0, 2) = z;
-            return ret;
+        inline matrix<T, 3, 1> to_matrix() const {
+            return matrix<T, 3, 1>{x, y, z};
         }
 };
 